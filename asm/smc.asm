@@ -0,0 +1,25 @@
+    .include "test-wrapper.asm"
+
+
+func:                           # r1 = value
+    add     r1, r1, 1           # value += 1
+    ret                         # return value
+
+
+test_main:
+    push    lr                  # push(lr)
+    mov     r1, zr              # value = 0
+    bl      @func               # value = func(value)
+    utx     r1                  # uart(value)
+    addpc   r2, @func           # ptr = &func
+    mov     r3, 0x10            # imm = 0x10
+    st      r3, r2, 1           # func.imm = imm
+    bl      @func               # value = func(value)
+    utx     r1                  # uart(value)
+    mov     r3, 0xa119          # instr = dec r1, r1
+    st      r3, r2, zr          # func[0] = instr (old imm is now a nop)
+    bl      @func               # value = func(value)
+    utx     r1                  # uart(value)
+    pop     lr                  # lr = pop()
+    mov     r1, zr              # out = 0
+    ret                         # return out
@@ -0,0 +1,845 @@
+#include <stdlib.h>
+
+#include "isim.h"
+
+
+// Return early from the current function on any status other than OK.
+#define TRY(x)                                      \
+    do                                              \
+    {                                               \
+        const int status_ = (x);                    \
+        if (status_ != ISIM_OK)                     \
+        {                                           \
+            return status_;                         \
+        }                                           \
+    } while (0)
+
+// Call a hook if it's bound. A request to stop is recorded so it can take
+// effect once the current instruction is complete.
+#define HOOK(sim, name, ...)                        \
+    do                                              \
+    {                                               \
+        if ((sim)->hooks.name)                      \
+        {                                           \
+            const int hook_ = (sim)->hooks.name(__VA_ARGS__); \
+            if (hook_ == ISIM_STOP)                 \
+            {                                       \
+                (sim)->stop = 1;                    \
+            }                                       \
+            else if (hook_ != ISIM_OK)              \
+            {                                       \
+                return hook_;                       \
+            }                                       \
+        }                                           \
+    } while (0)
+
+
+// Register with special meaning for the C operand and link register.
+#define REG_LR  (14)
+#define REG_SP  (15)
+
+
+// Names matching the keys of isa.ENCODINGS.
+static const char *MNEM_STR[ISIM_MNEM__NUM] =
+{
+    "add",
+    "sub",
+    "and",
+    "andn",
+    "or",
+    "xor",
+    "ld",
+    "st",
+    "ldm",
+    "stm",
+    "ld+",
+    "st+",
+    "+ld",
+    "+st",
+    "ld-",
+    "st-",
+    "-ld",
+    "-st",
+    "inc",
+    "dec",
+    "srl",
+    "sra",
+    "ror",
+    "rol",
+    "not",
+    "eq",
+    "ne",
+    "lt",
+    "ltu",
+    "ge",
+    "geu",
+    "any",
+    "inp",
+    "eqx",
+    "nex",
+    "ltx",
+    "ltux",
+    "gex",
+    "geux",
+    "anyx",
+    "inpx",
+    "addpc",
+    "b",
+    "j",
+    "bl",
+    "jl",
+    "in",
+    "out",
+    "outn",
+    "outp",
+    "urx",
+    "utx",
+    "getp",
+    "putp",
+    "cex",
+    "carry",
+    "andp",
+    "orp",
+};
+
+
+// Decoded instruction. The immediate is kept signed as in the python model as
+// this affects the carry out of ADD.
+typedef struct
+{
+    uint8_t     mnem;
+    uint8_t     op[ISIM_OP__NUM];
+    uint8_t     has_imm;
+    int32_t     imm;
+} instr_t;
+
+
+int isim_mnem_num(void)
+{
+    return ISIM_MNEM__NUM;
+}
+
+const char *isim_mnem_name(int mnem)
+{
+    return mnem >= 0 && mnem < ISIM_MNEM__NUM ? MNEM_STR[mnem] : NULL;
+}
+
+isim_t *isim_new(const isim_isa_t *isa)
+{
+    isim_t *sim = calloc(1, sizeof *sim);
+    if (!sim)
+    {
+        return NULL;
+    }
+
+    sim->isa = isa;
+
+    // Only ZR has a known value out of reset.
+    sim->regs_vld = 1;
+
+    for (int i = 0; i < 4; ++i)
+    {
+        sim->out_pins[i] = -1;
+    }
+
+    return sim;
+}
+
+void isim_free(isim_t *sim)
+{
+    free(sim);
+}
+
+// Load big-endian 16b words into memory starting from address zero.
+void isim_load(isim_t *sim, const uint8_t *data, uint32_t size)
+{
+    for (uint32_t i = 0; i < size / 2 && i < (1u << 16); ++i)
+    {
+        sim->mem[i] = (data[i * 2] << 8) | data[i * 2 + 1];
+        sim->mem_vld[i / 8] |= 1 << (i % 8);
+    }
+}
+
+
+// Check whether a memory address has been written.
+static inline int mem_vld(const isim_t *sim, uint16_t addr)
+{
+    return (sim->mem_vld[addr / 8] >> (addr % 8)) & 1;
+}
+
+// Read from memory, failing if the address is uninitialised.
+static inline int read_mem(isim_t *sim, uint16_t addr, uint16_t *value)
+{
+    if (!mem_vld(sim, addr))
+    {
+        sim->err = addr;
+        return ISIM_ERR_READ;
+    }
+
+    *value = sim->mem[addr];
+    return ISIM_OK;
+}
+
+static inline int write_mem(isim_t *sim, uint16_t addr, uint16_t value)
+{
+    sim->mem[addr] = value;
+    sim->mem_vld[addr / 8] |= 1 << (addr % 8);
+
+    HOOK(sim, write_mem, addr, value);
+    return ISIM_OK;
+}
+
+// Read a register, failing if it has never been written.
+static inline int read_reg(isim_t *sim, int reg, uint16_t *value)
+{
+    if (!((sim->regs_vld >> reg) & 1))
+    {
+        sim->err = reg;
+        return ISIM_ERR_REG;
+    }
+
+    *value = sim->regs[reg];
+    return ISIM_OK;
+}
+
+// Write a register, discarding writes to ZR.
+static inline int write_reg(isim_t *sim, int reg, uint16_t value)
+{
+    if (!reg)
+    {
+        return ISIM_OK;
+    }
+
+    sim->regs[reg] = value;
+    sim->regs_vld |= 1 << reg;
+
+    HOOK(sim, write_reg, reg, value);
+    return ISIM_OK;
+}
+
+// Read the C operand, which is either a register or the immediate.
+static inline int read_c(isim_t *sim, const instr_t *instr, int32_t *value)
+{
+    if (instr->has_imm)
+    {
+        *value = instr->imm;
+        return ISIM_OK;
+    }
+
+    uint16_t reg;
+    TRY(read_reg(sim, instr->op[ISIM_OP_C], &reg));
+
+    *value = reg;
+    return ISIM_OK;
+}
+
+// Write the predicate register, applying any AND/OR count op.
+static inline int write_pred(isim_t *sim, int value)
+{
+    if (sim->count_op == ISIM_COUNT_AND)
+    {
+        value = sim->pred && value;
+    }
+    else if (sim->count_op == ISIM_COUNT_OR)
+    {
+        value = sim->pred || value;
+    }
+
+    sim->pred = !!value;
+
+    HOOK(sim, write_pred, value);
+    return ISIM_OK;
+}
+
+static inline int write_cond(isim_t *sim, int value)
+{
+    sim->cond = value;
+
+    HOOK(sim, write_cond, value);
+    return ISIM_OK;
+}
+
+// Check whether the carry from the previous instruction should be used.
+static inline int carry_chain(const isim_t *sim)
+{
+    return sim->count_op == ISIM_COUNT_CARRY
+        && sim->num_count > 0
+        && sim->num_count < sim->max_count;
+}
+
+// Convert value from u16 to i16.
+static inline int32_t u2s(uint16_t value)
+{
+    return (int16_t)value;
+}
+
+
+// Fetch and decode the instruction at the PC.
+static inline int fetch(isim_t *sim, instr_t *instr)
+{
+    const isim_isa_t *isa = sim->isa;
+    const uint16_t pc = sim->pc;
+
+    if (!mem_vld(sim, pc))
+    {
+        sim->err = pc;
+        return ISIM_ERR_FETCH;
+    }
+
+    const uint16_t enc = sim->mem[pc];
+    instr->mnem = isa->mnem[enc];
+    instr->has_imm = 0;
+    instr->imm = 0;
+
+    if (instr->mnem == ISIM_MNEM_INVALID)
+    {
+        return ISIM_OK;
+    }
+
+    for (int i = 0; i < ISIM_OP__NUM; ++i)
+    {
+        const uint16_t mask = isa->mask[instr->mnem][i];
+        instr->op[i] = (enc & mask) >> isa->shift[instr->mnem][i];
+    }
+
+    // C of SP means the following 16b is a signed immediate.
+    if (isa->mask[instr->mnem][ISIM_OP_C] && instr->op[ISIM_OP_C] == REG_SP)
+    {
+        const uint16_t next = pc + 1;
+        if (!mem_vld(sim, next))
+        {
+            sim->err = next;
+            return ISIM_ERR_FETCH;
+        }
+
+        instr->has_imm = 1;
+        instr->imm = u2s(sim->mem[next]);
+    }
+
+    return ISIM_OK;
+}
+
+// Check for whether the next instruction should run, consuming a bit of the
+// cond state.
+static inline int check_run(isim_t *sim)
+{
+    if (sim->cond == 0 || sim->cond == 1)
+    {
+        return 1;
+    }
+
+    const int run = (sim->cond & 1) == sim->pred;
+    sim->cond >>= 1;
+
+    return run;
+}
+
+
+// ADD/SUB including carry in. Performed on signed values to match the carry
+// out of the python model when the immediate is negative.
+static int run_add_sub(isim_t *sim, const instr_t *instr)
+{
+    uint16_t lhs;
+    int32_t rhs;
+    TRY(read_reg(sim, instr->op[ISIM_OP_B], &lhs));
+    TRY(read_c(sim, instr, &rhs));
+
+    const int sub = instr->mnem == ISIM_MNEM_SUB;
+    int32_t cin = sub;
+    if (carry_chain(sim))
+    {
+        cin = sim->cin;
+    }
+
+    if (sub)
+    {
+        rhs = ~rhs & 0xffff;
+    }
+
+    const int32_t value = lhs + rhs + cin;
+    sim->cin = (value >> 16) & 1;
+
+    return write_reg(sim, instr->op[ISIM_OP_A], value & 0xffff);
+}
+
+// AND/ANDN/OR/XOR.
+static int run_bitwise(isim_t *sim, const instr_t *instr)
+{
+    uint16_t lhs;
+    int32_t rhs;
+    TRY(read_reg(sim, instr->op[ISIM_OP_B], &lhs));
+    TRY(read_c(sim, instr, &rhs));
+
+    int32_t value;
+    switch (instr->mnem)
+    {
+        case ISIM_MNEM_AND:     value = lhs & rhs;  break;
+        case ISIM_MNEM_ANDN:    value = lhs & ~rhs; break;
+        case ISIM_MNEM_OR:      value = lhs | rhs;  break;
+        default:                value = lhs ^ rhs;  break;
+    }
+
+    return write_reg(sim, instr->op[ISIM_OP_A], value & 0xffff);
+}
+
+// Comparisons, optionally setting cond state.
+static int run_cmp(isim_t *sim, const instr_t *instr)
+{
+    uint16_t lhs;
+    int32_t rhs_c;
+    TRY(read_reg(sim, instr->op[ISIM_OP_B], &lhs));
+    TRY(read_c(sim, instr, &rhs_c));
+
+    const uint16_t rhs = rhs_c & 0xffff;
+
+    int value;
+    int cmpx = 0;
+    switch (instr->mnem)
+    {
+        case ISIM_MNEM_EQX:     cmpx = 1;   // fall through
+        case ISIM_MNEM_EQ:      value = lhs == rhs;                 break;
+        case ISIM_MNEM_NEX:     cmpx = 1;   // fall through
+        case ISIM_MNEM_NE:      value = lhs != rhs;                 break;
+        case ISIM_MNEM_LTX:     cmpx = 1;   // fall through
+        case ISIM_MNEM_LT:      value = u2s(lhs) < u2s(rhs);        break;
+        case ISIM_MNEM_LTUX:    cmpx = 1;   // fall through
+        case ISIM_MNEM_LTU:     value = lhs < rhs;                  break;
+        case ISIM_MNEM_GEX:     cmpx = 1;   // fall through
+        case ISIM_MNEM_GE:      value = u2s(lhs) >= u2s(rhs);       break;
+        case ISIM_MNEM_GEUX:    cmpx = 1;   // fall through
+        case ISIM_MNEM_GEU:     value = lhs >= rhs;                 break;
+        case ISIM_MNEM_ANYX:    cmpx = 1;   // fall through
+        default:                value = (lhs & rhs) != 0;           break;
+    }
+
+    TRY(write_pred(sim, value));
+
+    if (cmpx)
+    {
+        TRY(write_cond(sim, 0x3));
+    }
+
+    return ISIM_OK;
+}
+
+// Branches and jumps, returning the target in *redirect.
+static int run_jmp(isim_t *sim, const instr_t *instr, int32_t *redirect)
+{
+    int32_t rhs;
+    TRY(read_c(sim, instr, &rhs));
+
+    const int branch = instr->mnem == ISIM_MNEM_B
+                    || instr->mnem == ISIM_MNEM_BL;
+    const int link = instr->mnem == ISIM_MNEM_BL
+                  || instr->mnem == ISIM_MNEM_JL;
+
+    const int32_t lhs = branch ? sim->pc : 0;
+
+    if (link)
+    {
+        TRY(write_reg(sim, REG_LR, (sim->pc + 1) & 0xffff));
+    }
+
+    *redirect = (lhs + rhs) & 0xffff;
+    return ISIM_OK;
+}
+
+// Loads and stores with optional writeback of the address.
+static int run_ld_st(isim_t *sim, const instr_t *instr)
+{
+    const int a = instr->op[ISIM_OP_A];
+    const int b = instr->op[ISIM_OP_B];
+
+    uint16_t base;
+    TRY(read_reg(sim, b, &base));
+
+    int32_t offset;
+    int post = 0;
+    int writeback = 1;
+    int store = 0;
+
+    switch (instr->mnem)
+    {
+        case ISIM_MNEM_ST:          store = 1;  // fall through
+        case ISIM_MNEM_LD:
+            TRY(read_c(sim, instr, &offset));
+            writeback = 0;
+            break;
+        case ISIM_MNEM_ST_POST_INC: store = 1;  // fall through
+        case ISIM_MNEM_LD_POST_INC: offset = 1;  post = 1; break;
+        case ISIM_MNEM_ST_PRE_INC:  store = 1;  // fall through
+        case ISIM_MNEM_LD_PRE_INC:  offset = 1;  break;
+        case ISIM_MNEM_ST_POST_DEC: store = 1;  // fall through
+        case ISIM_MNEM_LD_POST_DEC: offset = -1; post = 1; break;
+        case ISIM_MNEM_ST_PRE_DEC:  store = 1;  // fall through
+        default:                    offset = -1; break;
+    }
+
+    const uint16_t final_addr = (base + offset) & 0xffff;
+    const uint16_t addr = post ? base : final_addr;
+
+    // Stores always write back before reading the data so the update is
+    // visible when storing the base, while loads skip the writeback entirely
+    // if it would be overwritten by the load data.
+    if (store)
+    {
+        if (writeback)
+        {
+            TRY(write_reg(sim, b, final_addr));
+        }
+
+        uint16_t data;
+        TRY(read_reg(sim, a, &data));
+        return write_mem(sim, addr, data);
+    }
+
+    if (writeback && a != b)
+    {
+        TRY(write_reg(sim, b, final_addr));
+    }
+
+    uint16_t data;
+    TRY(read_mem(sim, addr, &data));
+    return write_reg(sim, a, data);
+}
+
+// Load/store multiple. Range R..S is inclusive and wraps.
+static int run_ldm_stm(isim_t *sim, const instr_t *instr)
+{
+    int r = instr->op[ISIM_OP_R];
+    const int s = instr->op[ISIM_OP_S];
+
+    uint16_t addr;
+    TRY(read_reg(sim, instr->op[ISIM_OP_B], &addr));
+
+    while (1)
+    {
+        uint16_t data;
+
+        if (instr->mnem == ISIM_MNEM_STM)
+        {
+            TRY(read_reg(sim, r, &data));
+            TRY(write_mem(sim, addr, data));
+        }
+        else
+        {
+            TRY(read_mem(sim, addr, &data));
+            TRY(write_reg(sim, r, data));
+        }
+
+        if (r == s)
+        {
+            return ISIM_OK;
+        }
+
+        r = (r + 1) & 15;
+        addr++;
+    }
+}
+
+// Single bit shifts and rotates.
+static int run_shift(isim_t *sim, const instr_t *instr)
+{
+    uint16_t value;
+    TRY(read_reg(sim, instr->op[ISIM_OP_B], &value));
+
+    int cin = instr->mnem == ISIM_MNEM_SRL ? 0 : (value >> 15) & 1;
+    if (carry_chain(sim))
+    {
+        cin = sim->cin;
+    }
+
+    switch (instr->mnem)
+    {
+        case ISIM_MNEM_SRL:
+        case ISIM_MNEM_SRA:
+            sim->cin = value & 1;
+            value = (value >> 1) | (cin << 15);
+            break;
+        case ISIM_MNEM_ROR:
+            value = (value >> 1) | (value << 15);
+            break;
+        default:
+            value = (value << 1) | (value >> 15);
+            break;
+    }
+
+    return write_reg(sim, instr->op[ISIM_OP_A], value);
+}
+
+// Input pins into a register or the predicate.
+static int run_in(isim_t *sim, const instr_t *instr)
+{
+    int value = 0;
+    HOOK(sim, read_pin, instr->op[ISIM_OP_N], &value);
+    value &= 1;
+
+    if (instr->mnem == ISIM_MNEM_IN)
+    {
+        return write_reg(sim, instr->op[ISIM_OP_A], value);
+    }
+
+    TRY(write_pred(sim, value));
+
+    if (instr->mnem == ISIM_MNEM_INPX)
+    {
+        TRY(write_cond(sim, 0x3));
+    }
+
+    return ISIM_OK;
+}
+
+// Output pins.
+static int run_out(isim_t *sim, const instr_t *instr)
+{
+    int value;
+
+    if (instr->mnem == ISIM_MNEM_OUTP)
+    {
+        value = sim->pred;
+    }
+    else
+    {
+        int32_t c;
+        TRY(read_c(sim, instr, &c));
+        value = c & 1;
+
+        if (instr->mnem == ISIM_MNEM_OUTN)
+        {
+            value = ~value & 1;
+        }
+    }
+
+    const int pin = instr->op[ISIM_OP_N];
+    sim->out_pins[pin] = value;
+
+    HOOK(sim, write_pin, pin, value);
+    return ISIM_OK;
+}
+
+// Set count op state for the following instructions.
+static int run_count(isim_t *sim, const instr_t *instr)
+{
+    sim->num_count = -1;
+    sim->max_count = instr->op[ISIM_OP_J];
+
+    switch (instr->mnem)
+    {
+        case ISIM_MNEM_CARRY:
+            sim->count_op = ISIM_COUNT_CARRY;
+            sim->cin = 0;
+            break;
+        case ISIM_MNEM_ANDP:
+            sim->count_op = ISIM_COUNT_AND;
+            break;
+        default:
+            sim->count_op = ISIM_COUNT_OR;
+            break;
+    }
+
+    return ISIM_OK;
+}
+
+// Run a decoded instruction, setting *redirect if the PC should change.
+static int execute(isim_t *sim, const instr_t *instr, int32_t *redirect)
+{
+    const int a = instr->op[ISIM_OP_A];
+    uint16_t value;
+    int32_t c;
+
+    switch (instr->mnem)
+    {
+        case ISIM_MNEM_ADD:
+        case ISIM_MNEM_SUB:
+            return run_add_sub(sim, instr);
+
+        case ISIM_MNEM_AND:
+        case ISIM_MNEM_ANDN:
+        case ISIM_MNEM_OR:
+        case ISIM_MNEM_XOR:
+            return run_bitwise(sim, instr);
+
+        case ISIM_MNEM_LD:
+        case ISIM_MNEM_ST:
+        case ISIM_MNEM_LD_POST_INC:
+        case ISIM_MNEM_ST_POST_INC:
+        case ISIM_MNEM_LD_PRE_INC:
+        case ISIM_MNEM_ST_PRE_INC:
+        case ISIM_MNEM_LD_POST_DEC:
+        case ISIM_MNEM_ST_POST_DEC:
+        case ISIM_MNEM_LD_PRE_DEC:
+        case ISIM_MNEM_ST_PRE_DEC:
+            return run_ld_st(sim, instr);
+
+        case ISIM_MNEM_LDM:
+        case ISIM_MNEM_STM:
+            return run_ldm_stm(sim, instr);
+
+        case ISIM_MNEM_INC:
+        case ISIM_MNEM_DEC:
+            TRY(read_reg(sim, instr->op[ISIM_OP_B], &value));
+            value += instr->mnem == ISIM_MNEM_INC ? 1 : -1;
+            return write_reg(sim, a, value);
+
+        case ISIM_MNEM_SRL:
+        case ISIM_MNEM_SRA:
+        case ISIM_MNEM_ROR:
+        case ISIM_MNEM_ROL:
+            return run_shift(sim, instr);
+
+        case ISIM_MNEM_NOT:
+            TRY(read_reg(sim, instr->op[ISIM_OP_B], &value));
+            return write_reg(sim, a, ~value);
+
+        case ISIM_MNEM_EQ:
+        case ISIM_MNEM_NE:
+        case ISIM_MNEM_LT:
+        case ISIM_MNEM_LTU:
+        case ISIM_MNEM_GE:
+        case ISIM_MNEM_GEU:
+        case ISIM_MNEM_ANY:
+        case ISIM_MNEM_EQX:
+        case ISIM_MNEM_NEX:
+        case ISIM_MNEM_LTX:
+        case ISIM_MNEM_LTUX:
+        case ISIM_MNEM_GEX:
+        case ISIM_MNEM_GEUX:
+        case ISIM_MNEM_ANYX:
+            return run_cmp(sim, instr);
+
+        case ISIM_MNEM_IN:
+        case ISIM_MNEM_INP:
+        case ISIM_MNEM_INPX:
+            return run_in(sim, instr);
+
+        case ISIM_MNEM_ADDPC:
+            TRY(read_c(sim, instr, &c));
+            return write_reg(sim, a, (sim->pc + c) & 0xffff);
+
+        case ISIM_MNEM_B:
+        case ISIM_MNEM_J:
+        case ISIM_MNEM_BL:
+        case ISIM_MNEM_JL:
+            return run_jmp(sim, instr, redirect);
+
+        case ISIM_MNEM_OUT:
+        case ISIM_MNEM_OUTN:
+        case ISIM_MNEM_OUTP:
+            return run_out(sim, instr);
+
+        case ISIM_MNEM_URX:
+        {
+            int data = 0;
+            HOOK(sim, read_uart, &data);
+            return write_reg(sim, a, data & 0xffff);
+        }
+
+        case ISIM_MNEM_UTX:
+            TRY(read_c(sim, instr, &c));
+            HOOK(sim, write_uart, c & 0xffff);
+            return ISIM_OK;
+
+        case ISIM_MNEM_GETP:
+            return write_reg(sim, a, sim->pred);
+
+        case ISIM_MNEM_PUTP:
+            TRY(read_c(sim, instr, &c));
+            return write_pred(sim, c & 1);
+
+        case ISIM_MNEM_CEX:
+            // Mask of zero has no end marker so can't be decoded.
+            if (!instr->op[ISIM_OP_M])
+            {
+                sim->err = sim->pc;
+                return ISIM_ERR_INSTR;
+            }
+            return write_cond(sim, instr->op[ISIM_OP_M]);
+
+        case ISIM_MNEM_CARRY:
+        case ISIM_MNEM_ANDP:
+        case ISIM_MNEM_ORP:
+            return run_count(sim, instr);
+
+        default:
+            sim->err = sim->pc;
+            return ISIM_ERR_INSTR;
+    }
+}
+
+// Run a single instruction. Follows the same sequence as Sim.tick.
+int isim_tick(isim_t *sim)
+{
+    instr_t instr;
+    TRY(fetch(sim, &instr));
+
+    const uint16_t next_pc = sim->pc + 1 + instr.has_imm;
+    sim->pc += instr.has_imm;
+
+    int32_t redirect = 0;
+    if (check_run(sim))
+    {
+        TRY(execute(sim, &instr, &redirect));
+    }
+
+    // The python model treats a redirect to zero as falling through, so the
+    // same is done here to remain identical.
+    if (redirect)
+    {
+        sim->pc = redirect;
+        HOOK(sim, redirect, redirect, next_pc);
+    }
+    else
+    {
+        sim->pc = next_pc;
+    }
+
+    // Update count op state, resetting once the counter elapses.
+    if (sim->num_count < sim->max_count)
+    {
+        sim->num_count++;
+    }
+    if (sim->num_count >= sim->max_count)
+    {
+        sim->count_op = ISIM_COUNT_NONE;
+    }
+
+    // Clear carry if persistence isn't set.
+    const int carry_vld = instr.mnem == ISIM_MNEM_ADD
+                       || instr.mnem == ISIM_MNEM_SUB
+                       || instr.mnem == ISIM_MNEM_SRA
+                       || instr.mnem == ISIM_MNEM_SRL;
+
+    if (sim->count_op != ISIM_COUNT_CARRY || !carry_vld)
+    {
+        sim->cin = 0;
+    }
+
+    sim->ticks++;
+
+    return ISIM_OK;
+}
+
+// Run until the tick limit is reached, a hook requests a stop, a breakpoint is
+// reached, or an error occurs. A breakpoint at the starting PC is ignored so a
+// run can resume from it.
+int isim_run(isim_t *sim, uint64_t max_ticks)
+{
+    for (uint64_t i = 0; i < max_ticks; ++i)
+    {
+        const uint16_t pc = sim->pc;
+        if (i && sim->breaks && (sim->breaks[pc >> 3] >> (pc & 7)) & 1)
+        {
+            return ISIM_BREAK;
+        }
+
+        TRY(isim_tick(sim));
+
+        if (sim->stop)
+        {
+            sim->stop = 0;
+            return ISIM_STOP;
+        }
+    }
+
+    return ISIM_OK;
+}
@@ -0,0 +1,197 @@
+#ifndef IDLI_ISIM_H
+#define IDLI_ISIM_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+// Instructions supported by the model. Names are exported so the python side
+// can build the decode table from isa.ENCODINGS by name.
+typedef enum
+{
+    ISIM_MNEM_ADD,
+    ISIM_MNEM_SUB,
+    ISIM_MNEM_AND,
+    ISIM_MNEM_ANDN,
+    ISIM_MNEM_OR,
+    ISIM_MNEM_XOR,
+    ISIM_MNEM_LD,
+    ISIM_MNEM_ST,
+    ISIM_MNEM_LDM,
+    ISIM_MNEM_STM,
+    ISIM_MNEM_LD_POST_INC,
+    ISIM_MNEM_ST_POST_INC,
+    ISIM_MNEM_LD_PRE_INC,
+    ISIM_MNEM_ST_PRE_INC,
+    ISIM_MNEM_LD_POST_DEC,
+    ISIM_MNEM_ST_POST_DEC,
+    ISIM_MNEM_LD_PRE_DEC,
+    ISIM_MNEM_ST_PRE_DEC,
+    ISIM_MNEM_INC,
+    ISIM_MNEM_DEC,
+    ISIM_MNEM_SRL,
+    ISIM_MNEM_SRA,
+    ISIM_MNEM_ROR,
+    ISIM_MNEM_ROL,
+    ISIM_MNEM_NOT,
+    ISIM_MNEM_EQ,
+    ISIM_MNEM_NE,
+    ISIM_MNEM_LT,
+    ISIM_MNEM_LTU,
+    ISIM_MNEM_GE,
+    ISIM_MNEM_GEU,
+    ISIM_MNEM_ANY,
+    ISIM_MNEM_INP,
+    ISIM_MNEM_EQX,
+    ISIM_MNEM_NEX,
+    ISIM_MNEM_LTX,
+    ISIM_MNEM_LTUX,
+    ISIM_MNEM_GEX,
+    ISIM_MNEM_GEUX,
+    ISIM_MNEM_ANYX,
+    ISIM_MNEM_INPX,
+    ISIM_MNEM_ADDPC,
+    ISIM_MNEM_B,
+    ISIM_MNEM_J,
+    ISIM_MNEM_BL,
+    ISIM_MNEM_JL,
+    ISIM_MNEM_IN,
+    ISIM_MNEM_OUT,
+    ISIM_MNEM_OUTN,
+    ISIM_MNEM_OUTP,
+    ISIM_MNEM_URX,
+    ISIM_MNEM_UTX,
+    ISIM_MNEM_GETP,
+    ISIM_MNEM_PUTP,
+    ISIM_MNEM_CEX,
+    ISIM_MNEM_CARRY,
+    ISIM_MNEM_ANDP,
+    ISIM_MNEM_ORP,
+
+    ISIM_MNEM__NUM,
+
+    // Encoding doesn't decode to a valid instruction.
+    ISIM_MNEM_INVALID = 0xff,
+} isim_mnem_t;
+
+
+// Operand fields that can be extracted from an encoding.
+typedef enum
+{
+    ISIM_OP_A,
+    ISIM_OP_B,
+    ISIM_OP_C,
+    ISIM_OP_N,
+    ISIM_OP_M,
+    ISIM_OP_J,
+    ISIM_OP_R,
+    ISIM_OP_S,
+
+    ISIM_OP__NUM
+} isim_op_t;
+
+
+// Result of running the model. Anything other than OK, STOP or BREAK is an
+// error and the offending address or register is saved in the err field.
+typedef enum
+{
+    ISIM_OK,
+    ISIM_STOP,
+    ISIM_BREAK,
+    ISIM_ERR_HOOK,
+    ISIM_ERR_FETCH,
+    ISIM_ERR_READ,
+    ISIM_ERR_REG,
+    ISIM_ERR_INSTR,
+} isim_status_t;
+
+
+// Operation applied by the count instructions to the following instructions.
+typedef enum
+{
+    ISIM_COUNT_NONE,
+    ISIM_COUNT_CARRY,
+    ISIM_COUNT_AND,
+    ISIM_COUNT_OR,
+} isim_count_t;
+
+
+// Decode table mapping every 16b encoding to an instruction, along with the
+// mask and shift for extracting each operand of that instruction. Filled in
+// from isa.DECODE_TABLE and isa.OPERAND_FIELDS.
+typedef struct
+{
+    uint8_t     mnem[1 << 16];
+    uint16_t    mask[ISIM_MNEM__NUM][ISIM_OP__NUM];
+    uint8_t     shift[ISIM_MNEM__NUM][ISIM_OP__NUM];
+} isim_isa_t;
+
+
+// Hooks into the model, mirroring sim.Callback. Any hook may be NULL, in which
+// case the event is ignored, and each returns an isim_status_t. Hooks
+// returning ISIM_STOP let the current instruction finish before the model
+// stops, while errors abort immediately.
+typedef struct
+{
+    int (*write_reg)(int reg, int value);
+    int (*write_pred)(int value);
+    int (*write_cond)(int value);
+    int (*write_mem)(int addr, int value);
+    int (*write_uart)(int value);
+    int (*read_uart)(int *value);
+    int (*write_pin)(int pin, int value);
+    int (*read_pin)(int pin, int *value);
+    int (*redirect)(int pc, int next_pc);
+} isim_hooks_t;
+
+
+// Architectural state followed by the memory image. Registers and memory have
+// a bit per entry indicating whether they have been written so uninitialised
+// reads are reported in the same way as the python model.
+typedef struct
+{
+    uint64_t        ticks;
+    uint16_t        pc;
+    uint16_t        regs[16];
+    uint16_t        regs_vld;
+    uint8_t         pred;
+    uint8_t         cond;
+    int8_t          num_count;
+    uint8_t         max_count;
+    uint8_t         count_op;
+    uint8_t         cin;
+    int8_t          out_pins[4];
+    uint8_t         stop;
+    uint16_t        err;
+
+    isim_hooks_t    hooks;
+    const isim_isa_t *isa;
+
+    // Bitmap of breakpoint addresses checked by isim_run, or NULL for none.
+    const uint8_t   *breaks;
+
+    uint16_t        mem[1 << 16];
+    uint8_t         mem_vld[(1 << 16) / 8];
+} isim_t;
+
+
+// Exported interface.
+int isim_mnem_num(void);
+const char *isim_mnem_name(int mnem);
+
+isim_t *isim_new(const isim_isa_t *isa);
+void isim_free(isim_t *sim);
+
+void isim_load(isim_t *sim, const uint8_t *data, uint32_t size);
+
+int isim_tick(isim_t *sim);
+int isim_run(isim_t *sim, uint64_t max_ticks);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // IDLI_ISIM_H
@@ -0,0 +1,45 @@
+#ifndef PODI_CRC_H
+#define PODI_CRC_H
+
+#include <stdint.h>
+
+#include "pico/types.h"
+
+
+// Reflected polynomial of the standard CRC32, matching zlib.crc32() on the
+// host.
+#define CRC32_POLY          (0xedb88320u)
+
+
+// Table of the CRC for each byte, filled by crc32_init().
+static uint32_t crc32_table[256];
+
+
+// Fill in the table, which must be done before any call to crc32().
+static inline void crc32_init(void)
+{
+    for (uint i = 0; i < 256; ++i)
+    {
+        uint32_t crc = i;
+        for (int b = 0; b < 8; ++b)
+        {
+            crc = (crc >> 1) ^ (crc & 1 ? CRC32_POLY : 0);
+        }
+
+        crc32_table[i] = crc;
+    }
+}
+
+// CRC32 of a buffer.
+static inline uint32_t crc32(const uint8_t *data, uint n)
+{
+    uint32_t crc = ~0u;
+    for (uint i = 0; i < n; ++i)
+    {
+        crc = crc32_table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    }
+
+    return ~crc;
+}
+
+#endif // PODI_CRC_H
@@ -2,12 +2,33 @@
 
 #include "hardware/gpio.h"
 #include "hardware/pio.h"
+#include "pico/multicore.h"
 #include "pico/stdio.h"
+#include "pico/time.h"
 
+#include "crc.h"
 #include "sqi.h"
+#include "trace.h"
 
 
-// GPIO pins to use for communication with idli.
+// GPIO pins to use for communication with idli. On the bus the data pins of
+// both memories sit side by side, followed by the clocks, as sqi_bus.pio
+// expects.
+#if PODI_SQI_BUS
+#define IDLI_MEM_LO_SIO_0   (2)
+#define IDLI_MEM_LO_SIO_1   (3)
+#define IDLI_MEM_LO_SIO_2   (4)
+#define IDLI_MEM_LO_SIO_3   (5)
+#define IDLI_MEM_HI_SIO_0   (6)
+#define IDLI_MEM_HI_SIO_1   (7)
+#define IDLI_MEM_HI_SIO_2   (8)
+#define IDLI_MEM_HI_SIO_3   (9)
+
+#define IDLI_MEM_LO_SCK     (10)
+#define IDLI_MEM_HI_SCK     (11)
+#define IDLI_MEM_LO_CS      (12)
+#define IDLI_MEM_HI_CS      (13)
+#else
 #define IDLI_MEM_LO_SIO_0   (2)
 #define IDLI_MEM_LO_SIO_1   (3)
 #define IDLI_MEM_LO_SIO_2   (4)
@@ -21,6 +42,7 @@
 #define IDLI_MEM_HI_SIO_3   (11)
 #define IDLI_MEM_HI_SCK     (12)
 #define IDLI_MEM_HI_CS      (13)
+#endif
 
 #define IDLI_RST_N          (16)
 
@@ -28,21 +50,60 @@
 #define IDLI_UART_RX        (21)
 
 
+// Maximum number of words in each flash frame, see cmd_flash().
+#define FLASH_FRAME_WORDS   (1024)
+#define FLASH_HEADER_SIZE   (6)
+
+// Replies to each flash frame.
+#define FLASH_ACK           (0x06)
+#define FLASH_NAK           (0x15)
+
+// Time allowed for each flash frame to arrive, and time the host must be quiet
+// for after a bad one before it's NAKed.
+#define FLASH_TIMEOUT_US    (1000000)
+#define FLASH_QUIET_US      (20000)
+
+
 // Commands supported by the device.
 typedef enum
 {
     CMD_PING,
     CMD_FLASH,
     CMD_RUN,
+    CMD_TRACE,
 
     CMD__NUM
 } cmd_t;
 
 
-// Low and high memories for idli to access via SQI.
+#if PODI_SQI_BUS
+// Both memories for idli to access via SQI over one bus, holding whole words.
+static sqi_t mem;
+
+static sqi_data_t mem_data[SQI_SIZE];
+
+// Store a word of the image.
+static void mem_store(uint16_t addr, uint16_t word)
+{
+    mem_data[addr] = word;
+}
+#else
+// Low and high memories for idli to access via SQI, and their contents.
 static sqi_t mem_lo;
 static sqi_t mem_hi;
 
+static sqi_data_t mem_lo_data[SQI_SIZE];
+static sqi_data_t mem_hi_data[SQI_SIZE];
+
+// Store a word of the image, split so LO holds nibbles 2 and 0 and HI holds
+// nibbles 3 and 1, each sending the higher first.
+static void mem_store(uint16_t addr, uint16_t word)
+{
+    mem_lo_data[addr] = ((word >> 4) & 0xf0) | (word & 0x0f);
+    mem_hi_data[addr] = ((word >> 8) & 0xf0) | ((word >> 4) & 0x0f);
+}
+#endif
+
 
 // Strings for printing commands back out to host for debug.
 static const char* CMD_STR[CMD__NUM] =
@@ -50,6 +111,7 @@ static const char* CMD_STR[CMD__NUM] =
     "PING",
     "FLASH",
     "RUN",
+    "TRACE",
 };
 
 
@@ -60,63 +122,205 @@ static void cmd_ping(void)
     stdio_puts("Ping!");
 }
 
-// Flash is used to download a new binary into the two memories. This command
-// takes a payload of the following format:
-//  - u16   Number of bytes to write to each memory, little endian.
-//  - u8*n  Bytes to write into low memory.
-//  - u8*n  Bytes to write into high memory.
+// Read exactly n bytes from the host in bulk, returning false if they don't
+// all arrive before the timeout.
+static bool read_bytes(uint8_t *buf, uint n, uint32_t timeout_us)
+{
+    const absolute_time_t until = make_timeout_time_us(timeout_us);
+
+    while (n > 0)
+    {
+        const int got = stdio_get_until((char *)buf, n, until);
+        if (got == PICO_ERROR_TIMEOUT)
+        {
+            return false;
+        }
+
+        buf += got;
+        n -= got;
+    }
+
+    return true;
+}
+
+// Little endian value of the given number of bytes.
+static uint32_t get_le(const uint8_t *buf, uint n)
+{
+    uint32_t value = 0;
+    for (uint i = 0; i < n; ++i)
+    {
+        value |= (uint32_t)buf[i] << (i * 8);
+    }
+
+    return value;
+}
+
+// Reply to a flash frame with the address expected next, little endian.
+static void flash_reply(uint8_t reply, uint32_t next)
+{
+    putchar_raw(reply);
+    for (int i = 0; i < 4; ++i)
+    {
+        putchar_raw((next >> (i * 8)) & 0xff);
+    }
+}
+
+// Drop everything from the host until it's been quiet for a while, so no part
+// of a bad frame or any sent after it is taken as the next frame.
+static void flash_drop(void)
+{
+    uint8_t buf[64];
+
+    while (stdio_get_until((char *)buf, sizeof buf,
+                           make_timeout_time_us(FLASH_QUIET_US))
+           != PICO_ERROR_TIMEOUT)
+    {
+    }
+}
+
+// Flash is used to download a new image into memory. The image is sent in
+// frames, each with the following format:
+//  - u32   Address of the first word, little endian.
+//  - u16   Number of words, at most FLASH_FRAME_WORDS, little endian. An empty
+//          frame ends the image.
+//  - u16*n Words, big endian as in the binary.
+//  - u32   CRC32 of everything above, little endian.
+//
+// The reply to each is an ACK or NAK byte followed by the address expected
+// next as a u32, and an ACK for that address is sent first to show podi is
+// ready. The host can send frames ahead of their replies. A frame that's out
+// of order, corrupt, or incomplete is NAKed once the host stops sending, and
+// everything after it dropped, so the host resends from the address given.
 static void cmd_flash(void)
 {
-    // Read in number of bytes to write.
-    uint16_t n = 0;
+    static uint8_t frame[FLASH_HEADER_SIZE + FLASH_FRAME_WORDS * 2 + 4];
+
+    uint next = 0;
+    uint naks = 0;
 
-    for (int i = 0; i < 2; ++i)
+    flash_reply(FLASH_ACK, next);
+
+    while (1)
     {
-        const int data = stdio_getchar_timeout_us(~0u);
-        if (data == PICO_ERROR_TIMEOUT)
+        if (!read_bytes(frame, FLASH_HEADER_SIZE, FLASH_TIMEOUT_US))
         {
-            stdio_puts("ERROR: Timeout waiting for flash payload size.");
+            stdio_puts("ERROR: Timeout waiting for flash frame.");
             return;
         }
 
-        n |= (data & 0xff) << (i * 8);
+        const uint32_t addr = get_le(&frame[0], 4);
+        const uint count = get_le(&frame[4], 2);
+        const uint size = FLASH_HEADER_SIZE + count * 2;
+
+        const bool ok = addr == next
+                     && count <= FLASH_FRAME_WORDS
+                     && addr + count <= SQI_SIZE
+                     && read_bytes(&frame[FLASH_HEADER_SIZE], count * 2 + 4,
+                                   FLASH_TIMEOUT_US)
+                     && crc32(frame, size) == get_le(&frame[size], 4);
+
+        if (!ok)
+        {
+            flash_drop();
+            flash_reply(FLASH_NAK, next);
+            naks++;
+            continue;
+        }
+
+        for (uint i = 0; i < count; ++i)
+        {
+            const uint8_t *word = &frame[FLASH_HEADER_SIZE + i * 2];
+            mem_store(addr + i, (word[0] << 8) | word[1]);
+        }
+
+        next += count;
+        flash_reply(FLASH_ACK, next);
+
+        if (count == 0)
+        {
+            break;
+        }
     }
 
-    stdio_printf("Flashing %u bytes to each memory.\n", n);
+    stdio_printf("Flashed %u words with %u frames resent.\n", next, naks);
+}
 
-    // Read bytes into each of the memories.
-    sqi_t *mems[] = { &mem_lo, &mem_hi };
+#if PODI_SQI_BUS
+// Run whatever is currently programmed into the memory by coming out of reset
+// and servicing memory accesses. One state machine serves both memories so
+// core 0 has the bus to itself, also sending a trace record to the host each
+// time CS is seen high. Records are only copied to the USB buffer when it has
+// room, so an access starting meanwhile waits for that copy but never on USB.
+static void __not_in_flash_func(cmd_run)(void)
+{
+    gpio_put(IDLI_RST_N, 1);
 
-    for (int i = 0; i < 2; ++i)
+    // TODO Need an end condition! Wait for UART end of test?
+    while (1)
     {
-        for (uint16_t b = 0; b < n; ++b)
+        if (!sqi_tick(&mem))
         {
-            const int data = stdio_getchar_timeout_us(~0u);
-            if (data == PICO_ERROR_TIMEOUT)
-            {
-                stdio_printf("ERROR: Memory %d: byte %u/%u timed out.", i, b, n);
-                return;
-            }
-
-            mems[i]->data[b] = data & 0xff;
+            trace_drain(&mem.trace);
         }
     }
-
-    stdio_puts("Flashing complete.");
+}
+#else
+// Service the high memory on core 1. Loops run from RAM so that flash accesses
+// by the other core can never stall them.
+static void __not_in_flash_func(run_hi)(void)
+{
+    while (1)
+    {
+        sqi_tick(&mem_hi);
+    }
 }
 
 // Run whatever is currently programmed into the memories by coming out of
-// reset and servicing memory accesses.
-static void cmd_run(void)
+// reset and servicing memory accesses. Each memory has a core to itself, as
+// HI runs half an SCK ahead of LO so sharing one halves the time each has to
+// respond. Core 0 also sends a trace record to the host each time LO is seen
+// deselected, alternating between the memories. Records are only copied to the
+// USB buffer when it has room, so an access starting meanwhile waits for that
+// copy but never on USB.
+static void __not_in_flash_func(cmd_run)(void)
 {
+    multicore_launch_core1(run_hi);
     gpio_put(IDLI_RST_N, 1);
 
     // TODO Need an end condition! Wait for UART end of test?
+    bool drain_hi = false;
     while (1)
     {
-        sqi_tick(&mem_hi);
-        sqi_tick(&mem_lo);
+        if (!sqi_tick(&mem_lo))
+        {
+            trace_drain(drain_hi ? &mem_hi.trace : &mem_lo.trace);
+            drain_hi = !drain_hi;
+        }
+    }
+}
+#endif
+
+// Set the level of trace records captured while running. This command takes
+// a payload of the following format:
+//  - u8    Trace level, see trace_level_t.
+static void cmd_trace(void)
+{
+    const int level = stdio_getchar_timeout_us(~0u);
+    if (level == PICO_ERROR_TIMEOUT)
+    {
+        stdio_puts("ERROR: Timeout waiting for trace level.");
+        return;
     }
+
+    if (level >= TRACE__NUM)
+    {
+        stdio_printf("ERROR: Invalid trace level: %d\n", level);
+        return;
+    }
+
+    trace_level = level;
+    stdio_printf("Trace level %d, compiled up to %d.\n", level,
+                 PODI_TRACE_MAX);
 }
 
 
@@ -126,6 +330,7 @@ static void (*CMD_FUNCS[CMD__NUM])(void) =
     cmd_ping,
     cmd_flash,
     cmd_run,
+    cmd_trace,
 };
 
 
@@ -133,6 +338,7 @@ int main(void)
 {
     // Receive commands via stdin from host.
     stdio_init_all();
+    crc32_init();
 
     // Configure GPIO pins excluding those controlled by PIO.
     gpio_init(IDLI_RST_N);
@@ -156,9 +362,14 @@ int main(void)
     // Hold idli in reset until a command wakes it up.
     gpio_put(IDLI_RST_N, 0);
 
-    // Initialise the PIO state machines for running the SQI interfaces.
-    sqi_init(&mem_lo, pio0, IDLI_MEM_LO_SIO_0, IDLI_MEM_LO_CS);
-    sqi_init(&mem_hi, pio1, IDLI_MEM_HI_SIO_0, IDLI_MEM_HI_CS);
+    // Initialise the PIO state machines for running the SQI interfaces. The
+    // bus ends transactions on LO CS as it's the later of the two.
+#if PODI_SQI_BUS
+    sqi_init(&mem, 2, mem_data, pio0, IDLI_MEM_LO_SIO_0, IDLI_MEM_LO_CS);
+#else
+    sqi_init(&mem_lo, 0, mem_lo_data, pio0, IDLI_MEM_LO_SIO_0, IDLI_MEM_LO_CS);
+    sqi_init(&mem_hi, 1, mem_hi_data, pio1, IDLI_MEM_HI_SIO_0, IDLI_MEM_HI_CS);
+#endif
 
     // Enter the main command loop.
     while (1)
@@ -1,10 +1,22 @@
 #ifndef PODI_SQI_H
 #define PODI_SQI_H
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <string.h>
 
+#include "hardware/dma.h"
+
 #include "sqi.pio.h"
+#include "sqi_bus.pio.h"
+#include "trace.h"
+
+
+// Whether both memories share one 8b bus served by a single state machine,
+// rather than each having its own. See sqi_bus.pio for the wiring.
+#ifndef PODI_SQI_BUS
+#define PODI_SQI_BUS        (0)
+#endif
 
 
 // Only support the READ/WRITE commands.
@@ -18,168 +30,290 @@ typedef enum
 // Current state.
 typedef enum
 {
-    SQI_STATE_INSTR,
-    SQI_STATE_ADDR_HI,
-    SQI_STATE_ADDR_LO,
-    SQI_STATE_RX,
-    SQI_STATE_TX_HI,
-    SQI_STATE_TX_LO,
+    SQI_STATE_IDLE,
+    SQI_STATE_CMD,
+    SQI_STATE_DATA,
 } sqi_state_t;
 
 
-// Each memory contains 64K bytes of data, an address, and the mode.
-// Extra PIO specific info is also maintained.
+// Data held for each address. On the bus that's a whole 16b word, otherwise
+// each memory holds a byte of two nibbles from it.
+#if PODI_SQI_BUS
+typedef uint16_t sqi_data_t;
+
+#define SQI_PROGRAM         (sqi_bus_program)
+#define SQI_OFFSET_START    (sqi_bus_offset_start)
+#define SQI_PIO_INIT        sqi_bus_pio_init
+#define SQI_DMA_SIZE        (DMA_SIZE_16)
+#else
+typedef uint8_t sqi_data_t;
+
+#define SQI_PROGRAM         (sqi_program)
+#define SQI_OFFSET_START    (sqi_offset_start)
+#define SQI_PIO_INIT        sqi_pio_init
+#define SQI_DMA_SIZE        (DMA_SIZE_8)
+#endif
+
+// Number of addresses in each memory.
+#define SQI_SIZE            (64 * 1024)
+
+
+// Each memory contains 64K entries of data, an address, and the mode. The PIO
+// runs the protocol and DMA the data phase, so the CPU only starts and ends
+// each transaction. Extra PIO and DMA specific info is also maintained, along
+// with the ring of trace records for the memory.
 typedef struct
 {
     sqi_mode_t  mode;
     uint16_t    addr;
     sqi_state_t state;
-    uint8_t     data[64 * 1024];
+    sqi_data_t  *data;
     PIO         pio;
     uint        offset;
     uint        sm;
-    io_rw_8     *txf;
-    io_rw_8     *rxf;
     uint        cs;
+    uint        dma_rx;
+    uint        dma_tx;
+    uint        dma_rx_wrap;
+    uint        dma_tx_wrap;
+    uint32_t    dma_count;
+    trace_ring_t trace;
+
+    // Number of times the PIO stalled because DMA or the core servicing the
+    // memory didn't keep up, see sqi_check_stalls().
+    uint32_t    overruns;
+    uint32_t    misses;
 } sqi_t;
 
 
-// Create a new SQI instance using the specified pins.
-static inline void sqi_init(sqi_t *sqi, PIO pio, uint sio0, uint cs)
+// Configure a DMA channel for the data phase, moving data between the PIO and
+// the memory and triggering the chained channel once it completes, which is
+// itself for none. Channels start ready to cover the whole memory from the
+// start, and the first of each pair has its address and count set as each
+// transaction starts.
+static inline void sqi_dma_init(sqi_t *sqi, uint ch, uint chain, bool is_tx)
+{
+    dma_channel_config cfg = dma_channel_get_default_config(ch);
+
+    channel_config_set_transfer_data_size(&cfg, SQI_DMA_SIZE);
+    channel_config_set_read_increment(&cfg, is_tx);
+    channel_config_set_write_increment(&cfg, !is_tx);
+    channel_config_set_dreq(&cfg, pio_get_dreq(sqi->pio, sqi->sm, is_tx));
+    channel_config_set_chain_to(&cfg, chain);
+
+    if (is_tx)
+    {
+        dma_channel_configure(ch, &cfg, &sqi->pio->txf[sqi->sm], sqi->data,
+                              SQI_SIZE, false);
+    }
+    else
+    {
+        dma_channel_configure(ch, &cfg, sqi->data, &sqi->pio->rxf[sqi->sm],
+                              SQI_SIZE, false);
+    }
+}
+
+// Create a new SQI instance using the specified pins and SQI_SIZE entries of
+// data. The ID identifies the memory in trace records.
+static inline void sqi_init(sqi_t *sqi, uint8_t id, sqi_data_t *data, PIO pio,
+                            uint sio0, uint cs)
 {
     memset(sqi, 0, sizeof *sqi);
 
     sqi->cs = cs;
+    sqi->data = data;
+    trace_init(&sqi->trace, id);
 
     sqi->pio = pio;
-    sqi->offset = pio_add_program(pio, &sqi_program);
+    sqi->offset = pio_add_program(pio, &SQI_PROGRAM);
     sqi->sm = pio_claim_unused_sm(pio, true);
 
-    sqi->txf = (io_rw_8 *)&pio->txf[sqi->sm];
-    sqi->rxf = (io_rw_8 *)&pio->rxf[sqi->sm];
+    // Each direction has a pair of channels, with the second carrying on from
+    // the start of the memory when an access wraps the address.
+    sqi->dma_rx = dma_claim_unused_channel(true);
+    sqi->dma_tx = dma_claim_unused_channel(true);
+    sqi->dma_rx_wrap = dma_claim_unused_channel(true);
+    sqi->dma_tx_wrap = dma_claim_unused_channel(true);
 
-    // Configure and start the PIO.
-    sqi_pio_init(pio, sqi->sm, sqi->offset, sio0, cs);
+    sqi_dma_init(sqi, sqi->dma_rx, sqi->dma_rx_wrap, false);
+    sqi_dma_init(sqi, sqi->dma_tx, sqi->dma_tx_wrap, true);
+    sqi_dma_init(sqi, sqi->dma_rx_wrap, sqi->dma_rx_wrap, false);
+    sqi_dma_init(sqi, sqi->dma_tx_wrap, sqi->dma_tx_wrap, true);
 
-    // Send two iterations worth of zero data to stay in IN mode until the first
-    // 8b of RX data has arrived.
-    *sqi->txf = 0;
-    *sqi->txf = 0;
+    // Configure and start the PIO, which waits for the first command.
+    SQI_PIO_INIT(pio, sqi->sm, sqi->offset, sio0);
 }
 
-// Single update cycle for the state machine.
-static inline void sqi_tick(sqi_t *sqi)
+// Count PIO stalls from the transaction that's just finished, each meaning a
+// FIFO deadline was missed. RX stalls are overruns from DMA not reading the RX
+// FIFO in time, or a write running a whole pass past the end of the memory. TX
+// stalls are misses from the DMA for a read not being started before the dummy
+// cycles ended, not refilling the TX FIFO in time, or running as far.
+static __force_inline void sqi_check_stalls(sqi_t *sqi)
 {
-    // If CS is pulled high then reset all state.
-    if (gpio_get(sqi->cs))
-    {
-        pio_sm_clear_fifos(sqi->pio, sqi->sm);
-        sqi->state = SQI_STATE_INSTR;
-        return;
-    }
+    const uint32_t rx = 1u << (PIO_FDEBUG_RXSTALL_LSB + sqi->sm);
+    const uint32_t tx = 1u << (PIO_FDEBUG_TXSTALL_LSB + sqi->sm);
 
-    // If there's nothing to read then try again next tick.
-    if (pio_sm_is_rx_fifo_empty(sqi->pio, sqi->sm))
+    const uint32_t stalls = sqi->pio->fdebug & (rx | tx);
+    if (!stalls)
     {
         return;
     }
 
-    // Grab the next 8b of data from the RX FIFO.
-    const uint8_t rx = *sqi->rxf;
+    // Flags are cleared by writing ones.
+    sqi->pio->fdebug = stalls;
 
-    // If waiting for instruction then parse it and set mode appropriately.
-    if (sqi->state == SQI_STATE_INSTR)
+    if (stalls & rx)
     {
-        sqi->mode = rx;
-
-        if (sqi->mode != SQI_MODE_READ && sqi->mode != SQI_MODE_WRITE)
-        {
-            stdio_printf("ERROR: Bad SQI mode: 0x%02x\n", rx);
-            return;
-        }
-
-        stdio_printf("SQI: mode=0x%02x\n", rx);
-
-        // Next we'll need to wait for the address to clock in, so update state
-        // and stay in IN mode for another 8b.
-        sqi->state = SQI_STATE_ADDR_HI;
-        *sqi->txf = 0;
-        *sqi->txf = 0;
-        return;
+        sqi->overruns++;
+        trace(&sqi->trace, TRACE_ERROR, TRACE_OP_OVERRUN, sqi->addr,
+              sqi->overruns);
     }
 
-    // Receive first 8b of address.
-    if (sqi->state == SQI_STATE_ADDR_HI)
+    if (stalls & tx)
     {
-        sqi->addr = rx;
-        sqi->state = SQI_STATE_ADDR_LO;
-        *sqi->txf = 0;
-        *sqi->txf = 0;
-        return;
+        sqi->misses++;
+        trace(&sqi->trace, TRACE_ERROR, TRACE_OP_MISS, sqi->addr,
+              sqi->misses);
     }
+}
 
-    // Receive final 8b of address.
-    if (sqi->state == SQI_STATE_ADDR_LO)
+// Finish a transaction once CS has gone high. Any data the PIO has pushed is
+// left for DMA to store before it's stopped, then the state machine restarts
+// ready for the next command.
+static __force_inline void sqi_end(sqi_t *sqi)
+{
+    if (sqi->state == SQI_STATE_DATA
+        && (sqi->mode == SQI_MODE_READ || sqi->mode == SQI_MODE_WRITE))
     {
-        sqi->addr = (sqi->addr << 8) | rx;
+        const bool read = sqi->mode == SQI_MODE_READ;
+        const uint ch = read ? sqi->dma_tx : sqi->dma_rx;
+        const uint wrap = read ? sqi->dma_tx_wrap : sqi->dma_rx_wrap;
+
+        // Anything left once DMA has made a whole pass after the end of the
+        // memory is dropped.
+        if (!read)
+        {
+            while (!pio_sm_is_rx_fifo_empty(sqi->pio, sqi->sm)
+                   && (dma_channel_is_busy(ch) || dma_channel_is_busy(wrap)))
+            {
+                tight_loop_contents();
+            }
+        }
+
+        // Entries moved by both channels, less any prefetched for a read that
+        // were never sent.
+        uint32_t count = sqi->dma_count
+                       - dma_channel_hw_addr(ch)->transfer_count
+                       + SQI_SIZE
+                       - dma_channel_hw_addr(wrap)->transfer_count;
+        if (read)
+        {
+            count -= pio_sm_get_tx_fifo_level(sqi->pio, sqi->sm);
+        }
 
-        stdio_printf("SQI: addr=0x%04x\n", sqi->addr);
+        // Aborting the first channel may trigger the chained one, so that's
+        // stopped after it, then left ready to wrap the next access.
+        dma_channel_abort(ch);
+        dma_channel_abort(wrap);
 
-        // If READ send out dummy byte then get ready TX.
-        // If WRITE remain in RX.
-        if (sqi->mode == SQI_MODE_READ)
+        if (read)
         {
-            sqi->state = SQI_STATE_TX_HI;
-            *sqi->txf = 1;
-            *sqi->txf = 1;
+            dma_channel_set_read_addr(wrap, sqi->data, false);
         }
         else
         {
-            sqi->state = SQI_STATE_RX;
-            *sqi->txf = 0;
-            *sqi->txf = 0;
+            dma_channel_set_write_addr(wrap, sqi->data, false);
         }
 
-        return;
+        dma_channel_set_trans_count(wrap, SQI_SIZE, false);
+
+        trace(&sqi->trace, TRACE_DATA, read ? TRACE_OP_TX : TRACE_OP_RX,
+              count > 0xffff ? 0xffff : count, 0);
+
+        sqi_check_stalls(sqi);
     }
 
-    // If RX store new data into the memory.
-    if (sqi->state == SQI_STATE_RX)
+    pio_sm_set_enabled(sqi->pio, sqi->sm, false);
+    pio_sm_clear_fifos(sqi->pio, sqi->sm);
+    pio_sm_restart(sqi->pio, sqi->sm);
+    pio_sm_exec(sqi->pio, sqi->sm,
+                pio_encode_jmp(sqi->offset + SQI_OFFSET_START));
+    pio_sm_set_enabled(sqi->pio, sqi->sm, true);
+
+    // Stalls from a transaction that never reached its data phase don't count.
+    sqi->pio->fdebug = (1u << (PIO_FDEBUG_RXSTALL_LSB + sqi->sm))
+                     | (1u << (PIO_FDEBUG_TXSTALL_LSB + sqi->sm));
+
+    sqi->state = SQI_STATE_IDLE;
+}
+
+// Single update cycle for the state machine. Returns whether CS is asserted,
+// i.e. a transaction may be in progress. The CPU only reads the command and
+// starts DMA from its address, then stops it when CS goes high, so nothing is
+// printed here and events are added to the trace ring instead. Always inlined
+// so it runs from RAM in the per-core loops.
+static __force_inline bool sqi_tick(sqi_t *sqi)
+{
+    // If CS is pulled high then end the transaction and reset all state.
+    if (gpio_get(sqi->cs))
     {
-        stdio_printf("SQI: RX addr=0x%04x data=0x%02x\n", sqi->addr, rx);
-        sqi->data[sqi->addr++] = rx;
+        if (sqi->state != SQI_STATE_IDLE)
+        {
+            sqi_end(sqi);
+        }
 
-        *sqi->txf = 0;
-        *sqi->txf = 0;
+        return false;
+    }
 
-        return;
+    if (sqi->state == SQI_STATE_IDLE)
+    {
+        sqi->state = SQI_STATE_CMD;
     }
 
-    // Remaining states are all sending data so need to wait for there to be
-    // enough space in the FIFO.
-    if (!pio_sm_is_tx_fifo_empty(sqi->pio, sqi->sm))
+    // Wait for the instruction and address, then the data phase needs nothing
+    // more until the end.
+    if (sqi->state != SQI_STATE_CMD
+        || pio_sm_is_rx_fifo_empty(sqi->pio, sqi->sm))
     {
-        return;
+        return true;
     }
 
-    // Send out the top or bottom nibble.
-    uint8_t tx = sqi->state == SQI_STATE_TX_HI ? (sqi->data[sqi->addr] >> 4)
-                                               : (sqi->data[sqi->addr] & 0xf);
+    const uint32_t cmd = pio_sm_get(sqi->pio, sqi->sm);
+    sqi->mode = (cmd >> 16) & 0xff;
+    sqi->addr = cmd & 0xffff;
 
-    stdio_printf("SQI: TX addr=0x%04x data=0x%x\n", sqi->addr, tx);
+    // The PIO carries on with the data phase of whichever command bit 0 picks,
+    // but nothing is transferred for a bad mode and it's ignored until CS goes
+    // high.
+    if (sqi->mode != SQI_MODE_READ && sqi->mode != SQI_MODE_WRITE)
+    {
+        trace(&sqi->trace, TRACE_ERROR, TRACE_OP_BAD_MODE, sqi->addr,
+              sqi->mode);
+        sqi->state = SQI_STATE_DATA;
+        return true;
+    }
+
+    trace(&sqi->trace, TRACE_CMD, TRACE_OP_CMD, sqi->addr, sqi->mode);
 
-    // Top 4b is data, bottom 4b is direction.
-    *sqi->txf = (tx << 4) | 1;
+    // The address wraps at the end of the memory as on the 23LC512, where the
+    // first channel chains to a second that carries on from the start. Writing
+    // the address triggers the channel.
+    sqi->dma_count = SQI_SIZE - sqi->addr;
 
-    if (sqi->state == SQI_STATE_TX_HI)
+    if (sqi->mode == SQI_MODE_READ)
     {
-        sqi->state = SQI_STATE_TX_LO;
+        dma_channel_set_trans_count(sqi->dma_tx, sqi->dma_count, false);
+        dma_channel_set_read_addr(sqi->dma_tx, &sqi->data[sqi->addr], true);
     }
     else
     {
-        sqi->state = SQI_STATE_TX_HI;
-        sqi->addr++;
+        dma_channel_set_trans_count(sqi->dma_rx, sqi->dma_count, false);
+        dma_channel_set_write_addr(sqi->dma_rx, &sqi->data[sqi->addr], true);
     }
+
+    sqi->state = SQI_STATE_DATA;
+    return true;
 }
 
 #endif // PODI_SQI_H
@@ -0,0 +1,188 @@
+#ifndef PODI_TRACE_H
+#define PODI_TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "hardware/sync.h"
+#include "hardware/timer.h"
+#include "tusb.h"
+
+
+// Trace levels, each including everything below it.
+typedef enum
+{
+    TRACE_OFF,
+    TRACE_ERROR,
+    TRACE_CMD,
+    TRACE_DATA,
+
+    TRACE__NUM
+} trace_level_t;
+
+// Highest level compiled in. Anything above it is removed entirely, so building
+// with 0 leaves no tracing in the SQI hot path.
+#ifndef PODI_TRACE_MAX
+#define PODI_TRACE_MAX      (TRACE_DATA)
+#endif
+
+// Number of records in each ring, which must be a power of two.
+#define TRACE_SIZE          (1024)
+
+// Byte sent ahead of each record so the host can pick them out of text output.
+#define TRACE_MARKER        (0x1e)
+
+
+// Events recorded by the SQI state machine.
+typedef enum
+{
+    TRACE_OP_CMD,
+    TRACE_OP_RX,
+    TRACE_OP_TX,
+    TRACE_OP_BAD_MODE,
+    TRACE_OP_DROP,
+    TRACE_OP_OVERRUN,
+    TRACE_OP_MISS,
+} trace_op_t;
+
+
+// Single trace record as sent to the host, little endian. The memory is held
+// in the top 4b of the op. Command records give the mode in the data, RX and
+// TX records the number of addresses transferred in the address, drop records
+// the number of records lost in the address, and overrun and miss records the
+// total so far in the data.
+typedef struct __attribute__((packed))
+{
+    uint32_t  time;
+    uint16_t  addr;
+    uint8_t   data;
+    uint8_t   op;
+} trace_rec_t;
+
+
+// Lock-free ring of records with a single producer, the core servicing the
+// memory, and a single consumer draining it. Indices count up forever and are
+// masked on access, so the ring is full when they're TRACE_SIZE apart.
+typedef struct
+{
+    trace_rec_t       recs[TRACE_SIZE];
+    volatile uint32_t head;
+    volatile uint32_t tail;
+    uint8_t           mem;
+
+    // Records dropped while the ring was full, and how many of those have been
+    // reported to the host.
+    volatile uint32_t dropped;
+    uint32_t          dropped_sent;
+} trace_ring_t;
+
+
+// Current level, set by the host.
+static volatile trace_level_t trace_level = TRACE_ERROR;
+
+
+// Reset a ring for the given memory.
+static inline void trace_init(trace_ring_t *ring, uint8_t mem)
+{
+    ring->head = 0;
+    ring->tail = 0;
+    ring->mem = mem;
+    ring->dropped = 0;
+    ring->dropped_sent = 0;
+}
+
+// Add a record to the ring if tracing is enabled at the level. When the level
+// is a constant above PODI_TRACE_MAX this compiles away to nothing. Always
+// inlined so it runs from RAM along with the SQI loops.
+static __force_inline void trace(trace_ring_t *ring, trace_level_t level,
+                                 trace_op_t op, uint16_t addr, uint8_t data)
+{
+    if (level > PODI_TRACE_MAX || level > trace_level)
+    {
+        return;
+    }
+
+    const uint32_t head = ring->head;
+    if (head - ring->tail >= TRACE_SIZE)
+    {
+        ring->dropped++;
+        return;
+    }
+
+    trace_rec_t *rec = &ring->recs[head & (TRACE_SIZE - 1)];
+    rec->time = timer_hw->timerawl;
+    rec->addr = addr;
+    rec->data = data;
+    rec->op = (ring->mem << 4) | op;
+
+    // Record must be visible before the consumer can see the new head.
+    __dmb();
+    ring->head = head + 1;
+}
+
+// Send a record to the host if the USB CDC buffer has room for it, without
+// blocking. Returns whether it was sent.
+static inline bool trace_send(const trace_rec_t *rec)
+{
+    uint8_t bytes[1 + sizeof *rec];
+    if (tud_cdc_write_available() < sizeof bytes)
+    {
+        return false;
+    }
+
+    bytes[0] = TRACE_MARKER;
+    memcpy(&bytes[1], rec, sizeof *rec);
+
+    tud_cdc_write(bytes, sizeof bytes);
+    tud_cdc_write_flush();
+    return true;
+}
+
+// Send at most one record to the host, reporting any that were dropped before
+// the next in the ring. This never blocks so it can run between accesses, and
+// records stay in the ring until USB has room for them. Returns whether the
+// ring still has records in it.
+static inline bool trace_drain(trace_ring_t *ring)
+{
+    const uint32_t dropped = ring->dropped;
+    if (dropped != ring->dropped_sent)
+    {
+        const uint32_t lost = dropped - ring->dropped_sent;
+        const trace_rec_t rec =
+        {
+            .time = timer_hw->timerawl,
+            .addr = lost > 0xffff ? 0xffff : lost,
+            .data = 0,
+            .op = (ring->mem << 4) | TRACE_OP_DROP,
+        };
+
+        if (trace_send(&rec))
+        {
+            ring->dropped_sent = dropped;
+        }
+
+        return true;
+    }
+
+    const uint32_t tail = ring->tail;
+    if (tail == ring->head)
+    {
+        return false;
+    }
+
+    // Read the record only after seeing the head that published it, and
+    // finish with it before handing the slot back to the producer.
+    __dmb();
+    const trace_rec_t rec = ring->recs[tail & (TRACE_SIZE - 1)];
+    __dmb();
+
+    if (trace_send(&rec))
+    {
+        ring->tail = tail + 1;
+    }
+
+    return ring->tail != ring->head;
+}
+
+#endif // PODI_TRACE_H
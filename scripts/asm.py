@@ -1,6 +1,7 @@
 import argparse
 import pathlib
 import sys
+import yaml
 
 from lark import Lark, Token
 from lark.exceptions import (
@@ -427,6 +428,20 @@ def encode(args, path, items, addrs):
         f.write(mem)
 
 
+# Write addresses of global labels to file for tools that want to name
+# addresses, such as the profiler. Local labels are skipped as they can't be
+# named uniquely.
+def write_symbols(args, path, labels):
+    log(args, '- Writing symbols file:', path)
+
+    symbols = {
+        name: addrs[0] for name, addrs in labels.items() if not name.isdigit()
+    }
+
+    with open(path, 'w') as f:
+        yaml.safe_dump(symbols, f)
+
+
 # Parse command line arguments.
 def parse_args():
     parser = argparse.ArgumentParser()
@@ -453,6 +468,13 @@ def parse_args():
         help='Path to output file.',
     )
 
+    parser.add_argument(
+        '-s',
+        '--symbols',
+        type=pathlib.Path,
+        help='Path to write label addresses to.',
+    )
+
     parser.add_argument(
         '-g',
         '--grammar',
@@ -488,3 +510,6 @@ if __name__ == '__main__':
     items, labels, addrs, _ = parse(args, args.input)
     resolve_labels(args, items, labels, addrs)
     encode(args, args.output, items, addrs)
+
+    if args.symbols:
+        write_symbols(args, args.symbols, labels)
@@ -171,6 +171,28 @@ def _check_encodings():
 _check_encodings()
 
 
+# Lookup table from every 16b encoding to its mnemonic, or None if the encoding
+# isn't a valid instruction. Built by expanding all combinations of the non
+# opcode bits for each instruction so decoding doesn't need to search.
+def _decode_table():
+    table = [None] * (1 << 16)
+
+    for mnem, opcode in OPCODES.items():
+        free = ~OPCODE_MASKS[mnem] & 0xffff
+
+        # Walk through every subset of the free bits.
+        bits = free
+        while True:
+            table[opcode | bits] = mnem
+            if not bits:
+                break
+            bits = (bits - 1) & free
+
+    return table
+
+DECODE_TABLE = _decode_table()
+
+
 # Mapping from synonym mnemonic to real instruction and operand substitutions.
 # Operands that aren't listed are assumed to be copied over directly.
 SYNONYMS = {
@@ -188,6 +210,21 @@ SYNONYMS = {
 OPERAND_ORDER = 'rsabncmj'
 
 
+# Operand fields for each instruction as a list of (operand, mask, shift) in the
+# order they appear in the syntax string. Value of an operand can be extracted
+# from an encoding with (enc & mask) >> shift.
+def _operand_fields(enc_str):
+    fields = []
+
+    for k in sorted(set(enc_str) - set('01?'), key=OPERAND_ORDER.index):
+        mask = int(''.join('1' if x == k else '0' for x in enc_str), 2)
+        fields.append((k, mask, (mask & -mask).bit_length() - 1))
+
+    return fields
+
+OPERAND_FIELDS = {k: _operand_fields(v) for k, v in ENCODINGS.items()}
+
+
 # Represents a single instruction.
 class Instruction:
     def __init__(self, mnem, ops, cond=None, cex_mask=None):
@@ -0,0 +1,455 @@
+import argparse
+import collections
+import ctypes
+import os
+import pathlib
+
+import isa
+import sim
+
+
+# Path to the shared library built from native/ by "make native". This can be
+# overridden with the IDLI_NATIVE_LIB environment variable.
+LIB_PATH = pathlib.Path(os.environ.get(
+    'IDLI_NATIVE_LIB',
+    pathlib.Path(__file__).resolve().parents[1]/'build/native/libisim.so',
+))
+
+# Status codes returned by the library, matching isim_status_t.
+OK = 0
+STOP = 1
+BREAK = 2
+ERR_HOOK = 3
+ERR_FETCH = 4
+ERR_READ = 5
+ERR_REG = 6
+ERR_INSTR = 7
+
+# Count operations in the same order as isim_count_t, using the same values as
+# Sim.count_op.
+COUNT_OPS = [None, 'carry', 'and', 'or']
+
+# Operands in the same order as isim_op_t.
+OPERANDS = 'abcnmjrs'
+
+# Mnemonic index for encodings that don't decode to an instruction.
+MNEM_INVALID = 0xff
+
+
+# Function types for the hooks. Read hooks return their value through the
+# pointer argument.
+_WRITE1 = ctypes.CFUNCTYPE(ctypes.c_int, ctypes.c_int)
+_WRITE2 = ctypes.CFUNCTYPE(ctypes.c_int, ctypes.c_int, ctypes.c_int)
+_READ0 = ctypes.CFUNCTYPE(ctypes.c_int, ctypes.POINTER(ctypes.c_int))
+_READ1 = ctypes.CFUNCTYPE(
+    ctypes.c_int,
+    ctypes.c_int,
+    ctypes.POINTER(ctypes.c_int),
+)
+
+
+# Mirrors isim_hooks_t.
+class _Hooks(ctypes.Structure):
+    _fields_ = [
+        ('write_reg', _WRITE2),
+        ('write_pred', _WRITE1),
+        ('write_cond', _WRITE1),
+        ('write_mem', _WRITE2),
+        ('write_uart', _WRITE1),
+        ('read_uart', _READ0),
+        ('write_pin', _WRITE2),
+        ('read_pin', _READ1),
+        ('redirect', _WRITE2),
+    ]
+
+# Hooks which must always be bound as they return a value. The base Callback
+# returns None for these which will raise in the same way as the python model.
+_READ_HOOKS = ('read_uart', 'read_pin')
+
+# Hooks which are always bound so they can be checked against the stop
+# conditions of run().
+_WATCH_HOOKS = ('write_uart', 'write_pin')
+
+
+# Mirrors isim_t.
+class _State(ctypes.Structure):
+    _fields_ = [
+        ('ticks', ctypes.c_uint64),
+        ('pc', ctypes.c_uint16),
+        ('regs', ctypes.c_uint16 * 16),
+        ('regs_vld', ctypes.c_uint16),
+        ('pred', ctypes.c_uint8),
+        ('cond', ctypes.c_uint8),
+        ('num_count', ctypes.c_int8),
+        ('max_count', ctypes.c_uint8),
+        ('count_op', ctypes.c_uint8),
+        ('cin', ctypes.c_uint8),
+        ('out_pins', ctypes.c_int8 * 4),
+        ('stop', ctypes.c_uint8),
+        ('err', ctypes.c_uint16),
+        ('hooks', _Hooks),
+        ('isa', ctypes.c_void_p),
+        ('breaks', ctypes.c_void_p),
+        ('mem', ctypes.c_uint16 * (1 << 16)),
+        ('mem_vld', ctypes.c_uint8 * ((1 << 16) // 8)),
+    ]
+
+
+# Library handle and decode table, loaded on first use as they're shared
+# between all instances.
+_lib = None
+_isa = None
+
+
+# Load the library and build the decode table from the ISA definitions.
+def _load():
+    global _lib, _isa
+
+    if _lib is not None:
+        return
+
+    if not LIB_PATH.is_file():
+        raise Exception(f'Native backend not built: {LIB_PATH}')
+
+    lib = ctypes.CDLL(str(LIB_PATH))
+
+    lib.isim_mnem_num.restype = ctypes.c_int
+    lib.isim_mnem_name.restype = ctypes.c_char_p
+    lib.isim_mnem_name.argtypes = [ctypes.c_int]
+    lib.isim_new.restype = ctypes.POINTER(_State)
+    lib.isim_new.argtypes = [ctypes.c_void_p]
+    lib.isim_free.argtypes = [ctypes.POINTER(_State)]
+    lib.isim_load.argtypes = [
+        ctypes.POINTER(_State),
+        ctypes.c_char_p,
+        ctypes.c_uint32,
+    ]
+    lib.isim_tick.restype = ctypes.c_int
+    lib.isim_tick.argtypes = [ctypes.POINTER(_State)]
+    lib.isim_run.restype = ctypes.c_int
+    lib.isim_run.argtypes = [ctypes.POINTER(_State), ctypes.c_uint64]
+
+    # Map mnemonics to the library's numbering by name.
+    num = lib.isim_mnem_num()
+    mnems = {lib.isim_mnem_name(i).decode(): i for i in range(num)}
+
+    if set(mnems) != set(isa.ENCODINGS):
+        raise Exception(f'Native backend ISA mismatch: {LIB_PATH}')
+
+    # Mirrors isim_isa_t.
+    class Isa(ctypes.Structure):
+        _fields_ = [
+            ('mnem', ctypes.c_uint8 * (1 << 16)),
+            ('mask', (ctypes.c_uint16 * len(OPERANDS)) * num),
+            ('shift', (ctypes.c_uint8 * len(OPERANDS)) * num),
+        ]
+
+    table = Isa()
+
+    table.mnem[:] = [
+        MNEM_INVALID if x is None else mnems[x] for x in isa.DECODE_TABLE
+    ]
+
+    for mnem, fields in isa.OPERAND_FIELDS.items():
+        for op, mask, shift in fields:
+            table.mask[mnems[mnem]][OPERANDS.index(op)] = mask
+            table.shift[mnems[mnem]][OPERANDS.index(op)] = shift
+
+    _lib = lib
+    _isa = table
+
+
+# Native implementation of sim.Sim. Architectural state is held by the library
+# and exposed through the same attributes as the python model. Memory is also
+# held by the library, loaded from Callback.image(), so fetch and read_mem are
+# never called. Other hooks are only called when the callback overrides them.
+class Sim:
+    def __init__(self, cb=sim.Callback(), verbose=False):
+        _load()
+
+        self.cb = cb
+        self.verbose = verbose
+
+        # Exception raised by a hook, re-raised once control returns from the
+        # library.
+        self.exc = None
+
+        # Stop conditions for the current call to run(), the bitmap of
+        # breakpoints passed to the library, and the last values sent over
+        # UART.
+        self.watch = None
+        self.breaks = None
+        self.uart_tail = collections.deque(
+            maxlen=len(sim.END_OF_TEST) + 1,
+        )
+
+        image = cb.image()
+        if image is None:
+            raise Exception('Native backend requires Callback.image()')
+
+        self.state = _lib.isim_new(ctypes.addressof(_isa))
+        if not self.state:
+            raise MemoryError('Failed to allocate native simulator')
+
+        _lib.isim_load(self.state, bytes(image), len(image))
+
+        # Bind hooks that the callback actually implements. References are
+        # kept so the function objects outlive the library's pointers to them.
+        self.hooks = {}
+        hooks = self.state.contents.hooks
+
+        for name, func_type in _Hooks._fields_:
+            func = sim.subscribed(cb, name)
+
+            if name in _READ_HOOKS:
+                self.hooks[name] = func_type(
+                    self._read_hook(getattr(cb, name)),
+                )
+            elif name in _WATCH_HOOKS:
+                self.hooks[name] = func_type(self._watch_hook(name, func))
+            elif func:
+                self.hooks[name] = func_type(self._write_hook(func))
+            else:
+                continue
+
+            setattr(hooks, name, self.hooks[name])
+
+    def __del__(self):
+        if getattr(self, 'state', None):
+            _lib.isim_free(self.state)
+            self.state = None
+
+    # Wrap a hook that doesn't return a value.
+    def _write_hook(self, func):
+        def hook(*args):
+            try:
+                func(*args)
+            except Exception as e:
+                self.exc = e
+                return ERR_HOOK
+
+            return OK
+
+        return hook
+
+    # Wrap a hook whose events can stop run(), calling the callback's hook if
+    # it has one.
+    def _watch_hook(self, name, func):
+        def hook(*args):
+            try:
+                if func:
+                    func(*args)
+
+                if self.watch and getattr(self.watch, name)(*args):
+                    return STOP
+            except Exception as e:
+                self.exc = e
+                return ERR_HOOK
+
+            return OK
+
+        return hook
+
+    # Wrap a hook that returns a value through the last argument.
+    def _read_hook(self, func):
+        def hook(*args):
+            *args, out = args
+
+            try:
+                out[0] = func(*args) & 0xffff
+            except Exception as e:
+                self.exc = e
+                return ERR_HOOK
+
+            return OK
+
+        return hook
+
+    # Raise an exception for an error status returned by the library.
+    def _check(self, status):
+        err = self.state.contents.err
+
+        if status == ERR_HOOK:
+            exc, self.exc = self.exc, None
+            raise exc
+        elif status == ERR_FETCH:
+            raise Exception(f'Fetch from uninitialised memory: 0x{err:04x}')
+        elif status == ERR_READ:
+            raise Exception(f'Read from uninitialised memory: 0x{err:04x}')
+        elif status == ERR_REG:
+            reg = isa.REGS_INV[err]
+            raise Exception(f'Read from uninitialised register: {reg}')
+        elif status == ERR_INSTR:
+            raise Exception(f'Invalid instruction: 0x{err:04x}')
+
+        return status
+
+    # Run a single instruction from memory. Unlike the python model there's no
+    # support for running an instruction directly or returning what was run.
+    def tick(self, instr=None):
+        if instr is not None:
+            raise Exception('Native backend can only run from memory')
+
+        self._check(_lib.isim_tick(self.state))
+
+    # Run a single instruction, matching the python model's block interface.
+    # The library is already fast enough per instruction that there's nothing
+    # to gain from translating blocks.
+    def tick_block(self, max_ticks=None):
+        self.tick()
+        return 1
+
+    # Run for up to max_ticks instructions or until one of the conditions in
+    # stop_on is met, matching sim.Sim.run().
+    def run(self, max_ticks, stop_on=()):
+        watch = sim.Watch(stop_on, self.uart_tail)
+        state = self.state.contents
+
+        if watch.breaks:
+            self.breaks = (ctypes.c_uint8 * ((1 << 16) // 8))()
+            for pc in watch.breaks:
+                self.breaks[pc >> 3] |= 1 << (pc & 7)
+
+            state.breaks = ctypes.addressof(self.breaks)
+        else:
+            self.breaks = None
+            state.breaks = None
+
+        start = self.ticks
+        self.watch = watch
+
+        try:
+            status = self._check(_lib.isim_run(self.state, max_ticks))
+        finally:
+            self.watch = None
+
+        if status == BREAK:
+            watch.reason = sim.STOP_BREAKPOINT
+
+        return watch.result(self.ticks - start, self.pc)
+
+    # Architectural state as plain values, matching sim.Sim.snapshot().
+    def snapshot(self):
+        return {
+            'ticks': self.ticks,
+            'pc': self.pc,
+            'regs': self.regs,
+            'pred': self.pred,
+            'cond': self.cond,
+            'count_op': self.count_op,
+            'num_count': self.num_count,
+            'max_count': self.max_count,
+            'cin': self.cin,
+            'out_pins': self.out_pins,
+            'uart_tail': list(self.uart_tail),
+        }
+
+    # Restore architectural state from snapshot(). The library holds its own
+    # copy of memory, so this is reloaded from the callback's memory if it has
+    # one, which has the same layout as the library's.
+    def restore(self, state):
+        st = self.state.contents
+
+        st.ticks = state['ticks']
+        st.pc = state['pc']
+        st.regs_vld = 0
+
+        for i, value in enumerate(state['regs']):
+            st.regs[i] = value or 0
+            if value is not None:
+                st.regs_vld |= 1 << i
+
+        st.pred = int(state['pred'])
+        st.cond = state['cond']
+        st.count_op = COUNT_OPS.index(state['count_op'])
+        st.num_count = state['num_count']
+        st.max_count = state['max_count'] or 0
+        st.cin = state['cin']
+
+        for i, value in enumerate(state['out_pins']):
+            st.out_pins[i] = -1 if value is None else value
+
+        self.uart_tail.clear()
+        self.uart_tail.extend(state['uart_tail'])
+
+        mem = getattr(self.cb, 'mem', None)
+        if mem is not None:
+            ctypes.memmove(st.mem, mem.words.tobytes(), ctypes.sizeof(st.mem))
+            ctypes.memmove(st.mem_vld, bytes(mem.vld), len(mem.vld))
+
+    # Log if verbose is enabled. Instructions aren't traced by the library so
+    # this is only used by callers of the simulator.
+    def _log(self, *args):
+        if self.verbose:
+            print(f'{self.ticks:6d} ', end='')
+            print(*args)
+
+    # Architectural state, matching the attributes of the python model.
+    @property
+    def ticks(self):
+        return self.state.contents.ticks
+
+    @property
+    def pc(self):
+        return self.state.contents.pc
+
+    @property
+    def regs(self):
+        state = self.state.contents
+        return [
+            x if (state.regs_vld >> i) & 1 else None
+            for i, x in enumerate(state.regs)
+        ]
+
+    @property
+    def pred(self):
+        return bool(self.state.contents.pred)
+
+    @property
+    def cond(self):
+        return self.state.contents.cond
+
+    @property
+    def num_count(self):
+        return self.state.contents.num_count
+
+    @property
+    def max_count(self):
+        return self.state.contents.max_count
+
+    @property
+    def count_op(self):
+        return COUNT_OPS[self.state.contents.count_op]
+
+    @property
+    def cin(self):
+        return self.state.contents.cin
+
+    @property
+    def out_pins(self):
+        return [x if x >= 0 else None for x in self.state.contents.out_pins]
+
+
+# Parse command line arguments.
+def parse_args():
+    parser = argparse.ArgumentParser()
+
+    parser.add_argument(
+        '-i',
+        '--isa',
+        type=pathlib.Path,
+        required=True,
+        help='Path to write the decode table to, for the native RTL bench.',
+    )
+
+    return parser.parse_args()
+
+
+# Write the decode table exactly as isim_isa_t is laid out in memory so it can
+# be loaded by programs linking against the library directly.
+if __name__ == '__main__':
+    args = parse_args()
+    _load()
+
+    with open(args.isa, 'wb') as f:
+        f.write(bytes(_isa))
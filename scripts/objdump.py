@@ -31,46 +31,28 @@ def decode(data, max_items=None):
     # Condition state for adding T/F flags.
     cond_state = ''
 
-    # Process bytes while there's more to handle.
-    while data:
-        # Search through all the instructions to find a matching opcode.
-        enc, = struct.unpack('>H', data[:2])
-        data = data[2:]
-
-        matches = []
-        for mnem, opcode in isa.OPCODES.items():
-            if (enc & isa.OPCODE_MASKS[mnem]) == opcode:
-                matches.append(mnem)
-
-        if matches:
-            if len(matches) > 1:
-                raise Exception(
-                    f'Multiple candidates for encoding 0x{enc:04x}: '
-                    f'{", ".join(matches)}'
-                )
-
-            mnem = matches[0]
-
-            # Extract operand values from the encoding string.
-            enc_str = isa.ENCODINGS[mnem]
-            ops = {k: None for k in enc_str if k not in '01?'}
-
-            for k in ops:
-                mask = int(''.join('1' if x == k else '0' for x in enc_str), 2)
-                value = (enc & mask) >> ((mask & -mask).bit_length() - 1)
-                ops[k] = value
-
-            # Sort operands into order based on the expected precedence in the
-            # syntax string.
+    # Process bytes while there's more to handle. Index into the data rather
+    # than slicing to avoid copying the remainder for every instruction.
+    pos = 0
+    while pos < len(data):
+        # Look up the mnemonic directly from the encoding.
+        enc, = struct.unpack_from('>H', data, pos)
+        pos += 2
+
+        mnem = isa.DECODE_TABLE[enc]
+
+        if mnem is not None:
+            # Extract operand values, which are already in order based on the
+            # expected precedence in the syntax string.
             ops = {
-                k: ops[k]
-                for k in sorted(ops, key=lambda x: isa.OPERAND_ORDER.index(x))
+                k: (enc & mask) >> shift
+                for k, mask, shift in isa.OPERAND_FIELDS[mnem]
             }
 
             # If C is SP then the next 16b is an immediate so parse this too.
             if ops.get('c') == isa.REGS['sp']:
-                ops['imm'], = struct.unpack('>h', data[:2])
-                data = data[2:]
+                ops['imm'], = struct.unpack_from('>h', data, pos)
+                pos += 2
 
             # If M is an op we need to parse the predicate state.
             cex_mask = None
@@ -1,13 +1,67 @@
 import argparse
 import pathlib
 import serial
+import stim
 import struct
+import zlib
 
 
 # Commands for sending to podi.
 CMD_PING  = b'\x00'
 CMD_FLASH = b'\x01'
 CMD_RUN   = b'\x02'
+CMD_TRACE = b'\x03'
+
+# Trace levels, as trace_level_t in podi/trace.h.
+TRACE_LEVELS = ['off', 'error', 'cmd', 'data']
+
+# Trace records are sent as a marker byte followed by the time in us, address,
+# data, and the memory and op packed into a byte.
+TRACE_MARKER = 0x1e
+TRACE_REC = struct.Struct('<IHBB')
+TRACE_OPS = [
+    'CMD',
+    'RX',
+    'TX',
+    'BAD_MODE',
+    'DROP',
+    'OVERRUN',
+    'MISS',
+]
+TRACE_MEMS = ['LO', 'HI', 'BUS']
+
+# Flash images are sent in frames of at most FLASH_FRAME_WORDS words, each a
+# header of the first address and number of words, the words, and a CRC32 of
+# both. Up to FLASH_WINDOW frames are sent ahead of their replies, each an ACK
+# or NAK and the address podi expects next. See cmd_flash() in podi/main.c.
+FLASH_WORDS = 64 * 1024
+FLASH_FRAME_WORDS = 1024
+FLASH_WINDOW = 8
+FLASH_RETRIES = 8
+FLASH_HEADER = struct.Struct('<IH')
+FLASH_CRC = struct.Struct('<I')
+FLASH_ACK = 0x06
+FLASH_NAK = 0x15
+FLASH_REPLY = struct.Struct('<I')
+
+
+# Format a trace record for printing.
+def trace_str(time, addr, data, op):
+    mem = TRACE_MEMS[op >> 4]
+    op = TRACE_OPS[op & 0xf]
+
+    if op == 'DROP':
+        return f'{time:10d} SQI_{mem}: {op} {addr} records\n'
+
+    # Data phases give the number of addresses transferred.
+    if op in ('RX', 'TX'):
+        return f'{time:10d} SQI_{mem}: {op} {addr} words\n'
+
+    # Overruns and misses give the running total, wrapping at 256.
+    if op in ('OVERRUN', 'MISS'):
+        return f'{time:10d} SQI_{mem}: {op} addr=0x{addr:04x} total={data}\n'
+
+    return f'{time:10d} SQI_{mem}: {op} addr=0x{addr:04x} data=0x{data:02x}\n'
 
 
 # Connects to the podi instance running on a pico and sends commands.
@@ -16,14 +70,43 @@ class Podi:
         # Open serial connection.
         self.tty = serial.Serial(port, baudrate=baud)
 
+    # Split bytes from the board into text and trace records, returning the
+    # text with records formatted and any incomplete record left over.
+    def _decode(self, buf):
+        text = ''
+
+        while buf:
+            if buf[0] == TRACE_MARKER:
+                if len(buf) <= TRACE_REC.size:
+                    break
+
+                text += trace_str(*TRACE_REC.unpack_from(buf, 1))
+                buf = buf[TRACE_REC.size + 1:]
+                continue
+
+            end = buf.find(TRACE_MARKER)
+            if end < 0:
+                end = len(buf)
+
+            text += buf[:end].decode('utf-8', errors='replace')
+            buf = buf[end:]
+
+        return text, buf
+
     # Send command bytes to the board and wait for the response.
     def _run(self, cmd, stream=False):
         self.tty.write(cmd)
         self.tty.flush()
 
+        return self._output(stream)
+
+    # Wait for the end of a command, returning its output.
+    def _output(self, stream=False):
         output = ''
+        buf = b''
         while True:
-            tmp = self.tty.read(self.tty.in_waiting).decode('utf-8')
+            buf += self.tty.read(self.tty.in_waiting)
+            tmp, buf = self._decode(buf)
             output += tmp
 
             if stream and tmp:
@@ -39,30 +122,88 @@ class Podi:
         output = self._run(CMD_PING)
         print(output)
 
-    # Run flash command to write data from file into memory.
+    # Wait for the reply to a flash frame, returning any text before it,
+    # whether it was an ACK, and the address podi expects next.
+    def _reply(self):
+        text = b''
+
+        while True:
+            byte = self.tty.read(1)
+            if byte[0] in (FLASH_ACK, FLASH_NAK):
+                break
+
+            # Errors end the command before any reply.
+            text += byte
+            if b'=== DONE ===' in text:
+                text = text.decode('utf-8', errors='replace')
+                raise Exception(f'Flash failed:\n{text}')
+
+        addr, = FLASH_REPLY.unpack(self.tty.read(FLASH_REPLY.size))
+        text = text.decode('utf-8', errors='replace')
+
+        return text, byte[0] == FLASH_ACK, addr
+
+    # Frame of words from the image starting at an address.
+    @staticmethod
+    def _frame(image, addr):
+        count = min(FLASH_FRAME_WORDS, len(image) - addr)
+        data = image.map[addr * 2:(addr + count) * 2] if count else b''
+
+        frame = FLASH_HEADER.pack(addr, count) + data
+        return frame + FLASH_CRC.pack(zlib.crc32(frame))
+
+    # Run flash command to write data from file into memory. The binary is
+    # memory mapped as with test stimulus, and sent as is in frames that are
+    # pipelined, going back to resend from wherever podi NAKs.
     def flash(self, path):
-        cmd = CMD_FLASH
-        n = 0
-        data_lo = b''
-        data_hi = b''
+        image = stim.Mapped(path)
+        if len(image) > FLASH_WORDS:
+            raise Exception(f'Binary too large: {len(image)} words')
+
+        self.tty.write(CMD_FLASH)
+        self.tty.flush()
+        output, _, _ = self._reply()
 
-        with open(path, 'rb') as f:
-            while data := f.read(2):
-                data, = struct.unpack('>H', data)
+        # Start of each frame, ending with an empty one.
+        starts = list(range(0, len(image), FLASH_FRAME_WORDS))
+        starts.append(len(image))
 
-                lo = ((data & 0x0f) >> 0) | ((data & 0x0f00) >> 4)
-                hi = ((data & 0xf0) >> 4) | ((data & 0xf000) >> 8)
+        sent = 0
+        acked = 0
+        retries = 0
 
-                data_lo += struct.pack('>B', lo)
-                data_hi += struct.pack('>B', hi)
+        while acked < len(starts):
+            while sent < len(starts) and sent - acked < FLASH_WINDOW:
+                self.tty.write(self._frame(image, starts[sent]))
+                sent += 1
 
-                n += 1
+            self.tty.flush()
+            text, ack, addr = self._reply()
+            output += text
 
-        cmd += struct.pack('<H', n)
-        cmd += data_lo
-        cmd += data_hi
+            if ack:
+                end = starts[min(acked + 1, len(starts) - 1)]
+                if addr != end:
+                    raise Exception(f'Flash ACK for 0x{addr:x}, not 0x{end:x}')
 
-        output = self._run(cmd)
+                acked += 1
+                continue
+
+            # Podi drops everything after a NAK, so go back to the frame it
+            # expects.
+            retries += 1
+            if retries > FLASH_RETRIES or addr not in starts:
+                raise Exception(f'Flash failed at 0x{addr:x}')
+
+            acked = starts.index(addr)
+            sent = acked
+
+        output += self._output()
+        print(output)
+
+    # Set the level of SQI trace records sent while running.
+    def trace(self, level):
+        output = self._run(CMD_TRACE + struct.pack('B', level))
         print(output)
 
     # Run whatever is in the memory.
@@ -96,6 +237,14 @@ def parse_args():
         help='Baud rate for serial port to Pico.',
     )
 
+    parser.add_argument(
+        '-t',
+        '--trace',
+        default='error',
+        choices=TRACE_LEVELS,
+        help='Level of SQI accesses to trace while running.',
+    )
+
     args = parser.parse_args()
 
     if not args.bin.is_file():
@@ -109,5 +258,6 @@ if __name__ == '__main__':
     podi = Podi(args.port, args.baud)
 
     podi.ping()
+    podi.trace(TRACE_LEVELS.index(args.trace))
     podi.flash(args.bin)
     podi.run()
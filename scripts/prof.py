@@ -0,0 +1,277 @@
+import bisect
+import collections
+import json
+import pathlib
+import re
+import yaml
+
+import objdump
+
+
+# Load the symbols written by the assembler alongside a binary, mapping label
+# names to addresses. Returns an empty mapping if there are none.
+def load_symbols(path):
+    path = pathlib.Path(f'{path}.sym')
+    if not path.is_file():
+        return {}
+
+    with open(path, 'r') as f:
+        return yaml.safe_load(f) or {}
+
+
+# Profile of a program running on the behavioural model. Sim calls tick() for
+# every instruction, from which execution counts, taken branches, and a call
+# graph are built. Calls are tracked on a shadow stack using BL/JL, and any
+# redirect to the return address of a frame on the stack returns from it. Costs
+# are counted in cycles if the timing model is enabled, otherwise instructions.
+class Profile:
+    # Instructions that call a function.
+    CALLS = set(['bl', 'jl'])
+
+    def __init__(self, symbols={}):
+        # Symbol names by address, taking the first name alphabetically if an
+        # address has more than one.
+        self.names = {}
+        for name, addr in sorted(symbols.items()):
+            self.names.setdefault(addr, name)
+
+        self.addrs = sorted(self.names)
+
+        # Times each PC ran and the cost of it.
+        self.counts = collections.Counter()
+        self.costs = collections.Counter()
+
+        # Taken redirects as (from, to) and the calls between functions as
+        # (caller, callee), by the number of times they occurred.
+        self.edges = collections.Counter()
+        self.calls = collections.Counter()
+
+        # Shadow call stack as (function, return address), starting in the
+        # function at the reset vector. The functions on the stack are kept as
+        # a tuple for looking up costs by stack.
+        self.stack = [(0, None)]
+        self.frames = (0,)
+        self.stacks = collections.Counter()
+
+        # Whether costs are cycles, and the cycle count after the previous
+        # instruction.
+        self.cycles = False
+        self.prev = None
+
+    # Record an instruction that was run from PC, whether it was actually run
+    # or skipped, and where it redirected to, if anywhere.
+    def tick(self, pc, instr, ran, redirect, timing):
+        cost = 1
+        if timing:
+            now = timing.periods * timing.PERIOD
+            if self.prev is None:
+                self.prev = timing.RESET * timing.PERIOD
+
+            cost = now - self.prev
+            self.prev = now
+            self.cycles = True
+
+        self.counts[pc] += 1
+        self.costs[pc] += cost
+        self.stacks[self.frames] += cost
+
+        if not redirect:
+            return
+
+        self.edges[pc, redirect] += 1
+
+        if instr.mnem in self.CALLS:
+            self.calls[self.stack[-1][0], redirect] += 1
+            self.stack.append((redirect, pc + instr.size()))
+        else:
+            # Return to the innermost frame with a matching address, ignoring
+            # the base frame as it has nowhere to return to.
+            for i in range(len(self.stack) - 1, 0, -1):
+                if self.stack[i][1] == redirect:
+                    del self.stack[i:]
+                    break
+            else:
+                return
+
+        self.frames = tuple(func for func, _ in self.stack)
+
+    # Name of an address, relative to the closest symbol before it.
+    def name(self, addr):
+        if addr in self.names:
+            return self.names[addr]
+
+        i = bisect.bisect(self.addrs, addr)
+        if not i:
+            return f'0x{addr:04x}'
+
+        base = self.addrs[i - 1]
+        return f'{self.names[base]}+0x{addr - base:x}'
+
+    # Self and inclusive cost for each function, where inclusive counts every
+    # function on the stack once.
+    def functions(self):
+        funcs = collections.defaultdict(lambda: [0, 0])
+
+        for frames, cost in self.stacks.items():
+            funcs[frames[-1]][0] += cost
+            for func in set(frames):
+                funcs[func][1] += cost
+
+        return funcs
+
+    # Split the executed instructions into basic blocks, returning a list of
+    # (start, number of instructions, times entered, cost). Blocks start at the
+    # reset vector, at branch targets, and after taken branches.
+    def blocks(self, sizes):
+        leaders = set([0])
+        for src, dst in self.edges:
+            leaders.add(dst)
+            leaders.add(src + sizes[src])
+
+        blocks = []
+        prev = None
+
+        for pc in sorted(self.counts):
+            if pc in leaders or prev is None or prev + sizes[prev] != pc:
+                blocks.append([pc, 0, self.counts[pc], 0])
+
+            blocks[-1][1] += 1
+            blocks[-1][3] += self.costs[pc]
+            prev = pc
+
+        return [tuple(x) for x in blocks]
+
+    # Disassemble the binary, annotating each executed instruction with its
+    # count and cost and labelling symbols. Runs of instructions that never
+    # ran are elided.
+    def listing(self, path):
+        lines, _ = objdump.objdump(path)
+        pattern = re.compile(r'^(?P<addr>[0-9a-f]+):')
+
+        out = []
+        skipped = False
+
+        for line in lines:
+            addr = int(pattern.match(line).group('addr'), 16)
+
+            if addr not in self.counts:
+                skipped = True
+                continue
+
+            if skipped and out:
+                out.append('')
+                out.append(f'{"":21}...')
+            skipped = False
+
+            if addr in self.names:
+                out.append('')
+                out.append(f'{"":21}{self.names[addr]}:')
+
+            count = self.counts[addr]
+            cost = self.costs[addr] if self.cycles else ''
+            out.append(f'{count:10} {cost:>8}  {line}')
+
+        return out
+
+    # Text report of the hottest functions and blocks, the call graph, and the
+    # annotated listing.
+    def report(self, path, top=20):
+        # Sizes of each instruction for finding block boundaries.
+        _, sizes = objdump.objdump(path)
+        addrs = [0]
+        for size in sizes:
+            addrs.append(addrs[-1] + size)
+        sizes = dict(zip(addrs, sizes))
+
+        unit = 'cycles' if self.cycles else 'instrs'
+        total = sum(self.costs.values())
+
+        lines = [
+            f'Instructions: {sum(self.counts.values())}',
+            f'Total {unit}: {total}',
+            '',
+            f'Functions by self {unit}:',
+            f'{"SELF":>10} {"%":>6} {"INCL":>10} {"%":>6}  FUNCTION',
+        ]
+
+        funcs = self.functions()
+        for func, (own, incl) in sorted(funcs.items(), key=lambda x: -x[1][0]):
+            lines.append(
+                f'{own:10} {own / total * 100:6.1f} '
+                f'{incl:10} {incl / total * 100:6.1f}  {self.name(func)}'
+            )
+
+        lines += [
+            '',
+            'Call graph:',
+            f'{"CALLS":>10}  CALLER -> CALLEE',
+        ]
+
+        for (caller, callee), count in self.calls.most_common():
+            lines.append(
+                f'{count:10}  {self.name(caller)} -> {self.name(callee)}'
+            )
+
+        lines += [
+            '',
+            f'Hottest {top} basic blocks by {unit}:',
+            f'{unit.upper():>10} {"%":>6} {"ENTERED":>10} {"SIZE":>5}  START',
+        ]
+
+        blocks = sorted(self.blocks(sizes), key=lambda x: -x[3])
+        for start, size, count, cost in blocks[:top]:
+            lines.append(
+                f'{cost:10} {cost / total * 100:6.1f} {count:10} {size:5}  '
+                f'0x{start:04x} {self.name(start)}'
+            )
+
+        lines += [
+            '',
+            'Annotated listing:',
+            f'{"COUNT":>10} {"CYCLES" if self.cycles else "":>8}',
+        ]
+
+        lines += self.listing(path)
+        return '\n'.join(lines) + '\n'
+
+    # Machine-readable profile. Addresses are stored as hex strings as JSON
+    # only supports string keys.
+    def json(self):
+        return {
+            'unit': 'cycles' if self.cycles else 'instrs',
+            'symbols': {f'0x{k:04x}': v for k, v in self.names.items()},
+            'counts': {f'0x{k:04x}': v for k, v in sorted(self.counts.items())},
+            'costs': {f'0x{k:04x}': v for k, v in sorted(self.costs.items())},
+            'edges': [
+                {'from': f'0x{src:04x}', 'to': f'0x{dst:04x}', 'count': count}
+                for (src, dst), count in sorted(self.edges.items())
+            ],
+            'calls': [
+                {
+                    'caller': self.name(caller),
+                    'callee': self.name(callee),
+                    'count': count,
+                }
+                for (caller, callee), count in self.calls.most_common()
+            ],
+        }
+
+    # Costs by call stack in the collapsed format used by flamegraph tools.
+    def folded(self):
+        lines = []
+        for frames, cost in sorted(self.stacks.items()):
+            lines.append(';'.join(self.name(x) for x in frames) + f' {cost}')
+
+        return '\n'.join(lines) + '\n'
+
+    # Write the text, JSON, and collapsed stack reports for the binary at PATH
+    # to files with the given prefix.
+    def write(self, prefix, path):
+        with open(f'{prefix}.txt', 'w') as f:
+            f.write(self.report(path))
+
+        with open(f'{prefix}.json', 'w') as f:
+            json.dump(self.json(), f, indent=2)
+
+        with open(f'{prefix}.folded', 'w') as f:
+            f.write(self.folded())
@@ -0,0 +1,496 @@
+import argparse
+import concurrent.futures
+import hashlib
+import json
+import os
+import pathlib
+import subprocess
+import sys
+import time
+import xml.etree.ElementTree as ET
+
+
+# Repository root, which all commands are run relative to.
+ROOT = pathlib.Path(__file__).resolve().parents[1]
+
+# Inputs that affect the result of each simulator other than the test itself.
+# Changing any of these re-runs every test on that simulator.
+SIM_INPUTS = ['scripts/*.py', 'scripts/*.lark']
+NATIVE_INPUTS = SIM_INPUTS + ['native/*.c', 'native/*.h']
+RTL_INPUTS = SIM_INPUTS + [
+    'src/*.sv',
+    'src/*.svh',
+    'test/*.sv',
+    'test/Makefile',
+    'test/run_test.py',
+]
+VERI_NATIVE_INPUTS = [
+    'src/*.sv',
+    'src/*.svh',
+    'test/idli_tb_m.sv',
+    'test/harness/*.cpp',
+    'test/harness/*.h',
+    'test/harness/*.vlt',
+    'native/*.c',
+    'native/*.h',
+    'scripts/isa.py',
+    'scripts/native.py',
+]
+
+# Binary built from test/harness by "make veri_native".
+VERI_NATIVE_BIN = ROOT/'build/veri_native/Vidli_tb_m'
+
+# Simulators that can record RTL cycle counts next to each test, in order of
+# preference. Only one writes them to avoid racing on the same file.
+CYCLES_SIMULATORS = ['veri_native', 'verilator']
+
+# As above for the number of instructions run by the behavioural model, which
+# is used to derive each test's timeout on later runs.
+TICKS_SIMULATORS = ['native', 'python']
+
+# Derived timeouts allow the models TICKS_MARGIN times the instruction count,
+# and RTL runs the same margin on the GCK cycles recorded by an earlier RTL
+# run, with at least TIMEOUT_MIN_NS. RTL runs without a cycle count use the
+# timeout given on the command line, which is always the limit.
+TICKS_MARGIN = 2
+GCK_PERIOD_NS = 2
+TIMEOUT_MIN_NS = 20000
+
+SIMULATORS = {
+    'python':       SIM_INPUTS,
+    'native':       NATIVE_INPUTS,
+    'veri_native':  VERI_NATIVE_INPUTS,
+    'verilator':    RTL_INPUTS,
+    'icarus':       RTL_INPUTS,
+}
+
+
+# A single test to run on a single simulator, with its own directory for logs
+# and build outputs so jobs can run in parallel.
+class Job:
+    def __init__(self, test, simulator, build, timeout, cycles=False,
+                 ticks=False):
+        # Paths are relative to the root of the repo, as every command is run
+        # from there whatever the working directory of this script.
+        self.test = ROOT/test
+        self.simulator = simulator
+        self.timeout = timeout
+        self.cycles = cycles
+        self.ticks = ticks
+
+        # Test name relative to the build directory, e.g. asm/qsort.
+        self.name = str(self.test.relative_to(ROOT/build).with_suffix(''))
+        self.yaml = ROOT/(self.name + '.yaml')
+
+        self.build = build
+        self.dir = ROOT/build/'regress'/simulator/self.name
+        self.log = self.dir/'log.txt'
+
+        # Filled in once the job has been run or skipped.
+        self.status = None
+        self.message = ''
+        self.time = 0.0
+
+    @property
+    def key(self):
+        return f'{self.simulator}:{self.name}'
+
+    # Hash of everything the result depends on.
+    def digest(self, input_hashes):
+        h = hashlib.sha256()
+        h.update(input_hashes[self.simulator].encode())
+        h.update(str(self.timeout).encode())
+
+        for path in (self.test, self.yaml):
+            h.update(str(path).encode())
+            h.update(_read(path))
+
+        return h.hexdigest()
+
+    # Count recorded next to the test with the given suffix, or None if it's
+    # missing or older than the test and its YAML.
+    def recorded(self, suffix):
+        path = pathlib.Path(f'{self.test}{suffix}')
+        if not path.is_file():
+            return None
+
+        inputs = max(self.test.stat().st_mtime, self.yaml.stat().st_mtime)
+        if path.stat().st_mtime < inputs:
+            return None
+
+        # The file may be being written by this run's job for the test.
+        try:
+            return int(path.read_text())
+        except ValueError:
+            return None
+
+    # Timeout for the run, derived from the instruction count or GCK cycles
+    # recorded next to the test.
+    def run_timeout(self):
+        if self.simulator in ('python', 'native'):
+            ticks = self.recorded('.ticks')
+            if ticks is None:
+                return self.timeout
+
+            timeout = ticks * TICKS_MARGIN
+        else:
+            cycles = self.recorded('.cycles')
+            if cycles is None:
+                return self.timeout
+
+            timeout = cycles * GCK_PERIOD_NS * TICKS_MARGIN
+            timeout = max(timeout, TIMEOUT_MIN_NS)
+
+        return min(timeout, self.timeout)
+
+    # Command and environment for running the job.
+    def command(self):
+        env = dict(os.environ)
+        timeout = self.run_timeout()
+
+        if self.simulator in ('python', 'native'):
+            # Instruction counts are only recorded next to the test by one
+            # simulator.
+            ticks = f'{self.test}.ticks'
+            if not self.ticks:
+                ticks = str(self.dir/'ticks')
+
+            cmd = [
+                sys.executable,
+                'scripts/sim.py',
+                str(self.test),
+                '--timeout', str(timeout),
+                '--yaml', str(self.yaml),
+                '--backend', self.simulator,
+                '--ticks', ticks,
+            ]
+            return cmd, env
+
+        # Cycle counts are only recorded next to the test by one simulator.
+        cycles = f'{self.test}.cycles'
+        if not self.cycles:
+            cycles = str(self.dir/'cycles')
+
+        if self.simulator == 'veri_native':
+            cmd = [
+                str(VERI_NATIVE_BIN),
+                f'+test={self.test}',
+                f'+yaml={self.yaml}',
+                f'+timeout={timeout}',
+                f'+cycles={cycles}',
+                f'+waves={self.dir/"waves.fst"}',
+                '+verilator+rand+reset+2',
+            ]
+            return cmd, env
+
+        # Other RTL runs go straight to the cocotb Makefile with a private
+        # build directory, as lint and sv2v have already been run. The model
+        # was compiled once by prepare() and is shared by every test.
+        env.update({
+            'SIM_TEST':     str(self.test),
+            'SIM_YAML':     str(self.yaml),
+            'SIM_TIMEOUT':  str(timeout),
+            'SIM_CYCLES':   cycles,
+            'TEST_BUILD':   str(self.dir),
+            'SIM_BUILD':    str(sim_build(self.build, self.simulator)),
+            'COCOTB_LOG_LEVEL': env.get('COCOTB_LOG_LEVEL', 'WARNING'),
+        })
+
+        return ['make', '-C', 'test', f'RTL_SIM={self.simulator}'], env
+
+    # Run the job, saving all output to the log.
+    def run(self):
+        self.dir.mkdir(parents=True, exist_ok=True)
+        cmd, env = self.command()
+
+        start = time.monotonic()
+        with open(self.log, 'w') as f:
+            result = subprocess.run(
+                cmd,
+                cwd=ROOT,
+                env=env,
+                stdout=f,
+                stderr=subprocess.STDOUT,
+            )
+        self.time = time.monotonic() - start
+
+        self.status = 'pass'
+        if result.returncode:
+            self.status = 'fail'
+            self.message = f'Exited with code {result.returncode}'
+        elif (failure := self._cocotb_failure()) is not None:
+            self.status = 'fail'
+            self.message = failure
+
+        return self
+
+    # Check the cocotb results file for failures, as the simulator exiting
+    # cleanly doesn't mean the test passed.
+    def _cocotb_failure(self):
+        if self.simulator in ('python', 'native', 'veri_native'):
+            return None
+
+        results = self.dir/'results.xml'
+        if not results.is_file():
+            return 'No cocotb results file'
+
+        for failure in ET.parse(results).iter('failure'):
+            return failure.get('message') or 'Test failed'
+
+        return None
+
+
+# Read a file relative to the repository root.
+def _read(path):
+    with open(ROOT/path, 'rb') as f:
+        return f.read()
+
+
+# Hash the shared inputs of each simulator once up front.
+def hash_inputs(simulators):
+    hashes = {}
+
+    for simulator in simulators:
+        h = hashlib.sha256()
+        for pattern in SIMULATORS[simulator]:
+            for path in sorted(ROOT.glob(pattern)):
+                h.update(str(path.relative_to(ROOT)).encode())
+                h.update(_read(path))
+
+        hashes[simulator] = h.hexdigest()
+
+    return hashes
+
+
+# Directory holding the model compiled for a cocotb simulator, shared by all of
+# its tests.
+def sim_build(build, simulator):
+    return ROOT/build/'regress'/simulator/'sim_build'
+
+
+# Run anything that has to happen once before the RTL simulations, such as
+# converting sources with sv2v and compiling the cocotb models.
+def prepare(simulators, build, jobs):
+    targets = []
+    if 'verilator' in simulators:
+        targets.append('lint')
+    if 'icarus' in simulators:
+        targets.append('sv2v')
+    if 'native' in simulators:
+        targets.append('native')
+    if 'veri_native' in simulators:
+        targets.append('veri_native')
+
+    if targets:
+        subprocess.run(['make', f'-j{jobs}'] + targets, cwd=ROOT, check=True)
+
+    for simulator in ('verilator', 'icarus'):
+        if simulator in simulators:
+            subprocess.run(
+                [
+                    'make', '-C', 'test', f'-j{jobs}',
+                    f'RTL_SIM={simulator}',
+                    f'SIM_BUILD={sim_build(build, simulator)}',
+                    'sim_model',
+                ],
+                cwd=ROOT,
+                check=True,
+            )
+
+
+# Write the results as JUnit XML and JSON.
+def write_report(jobs, out_dir, wall):
+    suites = ET.Element('testsuites', time=f'{wall:.3f}')
+
+    for simulator in dict.fromkeys(x.simulator for x in jobs):
+        group = [x for x in jobs if x.simulator == simulator]
+
+        suite = ET.SubElement(
+            suites,
+            'testsuite',
+            name=simulator,
+            tests=str(len(group)),
+            failures=str(sum(x.status == 'fail' for x in group)),
+            skipped=str(sum(x.status == 'skip' for x in group)),
+            time=f'{sum(x.time for x in group):.3f}',
+        )
+
+        for job in group:
+            case = ET.SubElement(
+                suite,
+                'testcase',
+                classname=simulator,
+                name=job.name,
+                time=f'{job.time:.3f}',
+            )
+
+            if job.status == 'fail':
+                failure = ET.SubElement(case, 'failure', message=job.message)
+                failure.text = str(job.log)
+            elif job.status == 'skip':
+                ET.SubElement(case, 'skipped', message=job.message)
+
+    ET.ElementTree(suites).write(out_dir/'results.xml', xml_declaration=True)
+
+    report = {
+        'wall_time': wall,
+        'jobs': [
+            {
+                'test': job.name,
+                'simulator': job.simulator,
+                'status': job.status,
+                'message': job.message,
+                'time': job.time,
+                'log': str(job.log),
+            }
+            for job in jobs
+        ],
+    }
+
+    with open(out_dir/'results.json', 'w') as f:
+        json.dump(report, f, indent=2)
+
+
+# Parse command line arguments.
+def parse_args():
+    parser = argparse.ArgumentParser()
+
+    parser.add_argument(
+        '-j',
+        '--jobs',
+        type=int,
+        default=os.cpu_count(),
+        help='Number of jobs to run in parallel.',
+    )
+
+    parser.add_argument(
+        '-s',
+        '--simulators',
+        default='python,verilator,icarus',
+        help='Comma separated list of simulators to run each test on.',
+    )
+
+    parser.add_argument(
+        '-t',
+        '--timeout',
+        default=500000,
+        type=int,
+        help='Timeout passed to each simulator.',
+    )
+
+    parser.add_argument(
+        '-b',
+        '--build',
+        default='build',
+        type=pathlib.Path,
+        help='Build directory containing the assembled tests.',
+    )
+
+    parser.add_argument(
+        '-f',
+        '--force',
+        action='store_true',
+        help='Run every job, even if its inputs are unchanged.',
+    )
+
+    parser.add_argument(
+        'tests',
+        metavar='TEST',
+        nargs='*',
+        type=pathlib.Path,
+        help='Tests to run, defaulting to every test in the build directory.',
+    )
+
+    args = parser.parse_args()
+
+    args.simulators = args.simulators.split(',')
+    for simulator in args.simulators:
+        if simulator not in SIMULATORS:
+            raise Exception(f'Unknown simulator: {simulator}')
+
+    if not args.tests:
+        args.tests = sorted((ROOT/args.build/'asm').rglob('*.out'))
+
+    if not args.tests:
+        raise Exception(f'No tests found in: {args.build}')
+
+    return args
+
+
+if __name__ == '__main__':
+    args = parse_args()
+
+    out_dir = ROOT/args.build/'regress'
+    out_dir.mkdir(parents=True, exist_ok=True)
+
+    # Hashes of the inputs to jobs that passed on previous runs.
+    state_path = out_dir/'state.json'
+    state = {}
+    if state_path.is_file() and not args.force:
+        with open(state_path, 'r') as f:
+            state = json.load(f)
+
+    prepare(args.simulators, args.build, args.jobs)
+    input_hashes = hash_inputs(args.simulators)
+
+    cycles = next((x for x in CYCLES_SIMULATORS if x in args.simulators), None)
+    ticks = next((x for x in TICKS_SIMULATORS if x in args.simulators), None)
+
+    jobs = [
+        Job(
+            test,
+            simulator,
+            args.build,
+            args.timeout,
+            simulator == cycles,
+            simulator == ticks,
+        )
+        for test in args.tests
+        for simulator in args.simulators
+    ]
+
+    digests = {job.key: job.digest(input_hashes) for job in jobs}
+
+    # Skip anything that passed last time with the same inputs.
+    pending = []
+    for job in jobs:
+        if state.get(job.key) == digests[job.key]:
+            job.status = 'skip'
+            job.message = 'Inputs unchanged since last pass'
+        else:
+            pending.append(job)
+
+    start = time.monotonic()
+
+    with concurrent.futures.ThreadPoolExecutor(args.jobs) as pool:
+        for job in concurrent.futures.as_completed(
+            pool.submit(x.run) for x in pending
+        ):
+            job = job.result()
+            print(f'{job.status.upper():4}  {job.simulator:11}  {job.name}  '
+                  f'({job.time:.1f}s)', flush=True)
+
+            # Only remember passes so failures are always re-run.
+            if job.status == 'pass':
+                state[job.key] = digests[job.key]
+            else:
+                state.pop(job.key, None)
+
+    wall = time.monotonic() - start
+
+    with open(state_path, 'w') as f:
+        json.dump(state, f, indent=2)
+
+    write_report(jobs, out_dir, wall)
+
+    failed = [x for x in jobs if x.status == 'fail']
+    skipped = sum(x.status == 'skip' for x in jobs)
+
+    print(f'\n{len(jobs)} jobs, {len(failed)} failed, {skipped} skipped, '
+          f'{wall:.1f}s')
+
+    for job in failed:
+        print(f'FAIL  {job.simulator:11}  {job.name}  {job.log}')
+
+    if failed:
+        sys.exit(1)
@@ -1,31 +1,24 @@
 #!/usr/bin/env bash
 
+# Assemble every test then run them all on each simulator in parallel. Any
+# arguments are passed on to regress.py, e.g. --force to re-run tests that
+# passed last time and haven't changed since.
+
 set -e
 
 unset SIM_TEST
 unset SIM_TIMEOUT
 unset SIM_DEBUG
 unset SIM_YAML
+unset SIM_CYCLES
 
-make clean
 make -j8 asm
-make -j8 sv2v
-
-export COCOTB_LOG_LEVEL=WARNING
 
-TESTS=$(find build/asm -type f -name '*.out')
+. build/venv/bin/activate
+python scripts/regress.py "$@"
 
-for TEST in $TESTS; do
-    echo "===================="
-    echo "$TEST"
-    echo "===================="
-
-    make -j8 run_sim SIM_TEST="$TEST"
-    make -j8 run_veri SIM_TEST="$TEST"
-    make -j8 run_icarus SIM_TEST="$TEST"
-done
+make timing_report
 
 echo "===================="
 echo "    ALL PASSED      "
 echo "===================="
-
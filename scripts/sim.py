@@ -1,9 +1,15 @@
 import argparse
+import collections
+import functools
 import pathlib
 import struct
+import sys
 import yaml
 
+from array import array
+
 import isa
+import stim
 
 from objdump import decode
 
@@ -55,13 +61,417 @@ class Callback:
     def redirect(self, pc, next_pc):
         pass
 
+    # Called by backends that hold their own copy of memory to get the initial
+    # contents as bytes of big-endian 16b words starting from address zero.
+    def image(self):
+        return None
+
+
+# Hooks of a callback that are only called if it overrides them, as the
+# defaults ignore the event. Reads and fetch are always called as their
+# results are used.
+OPTIONAL_HOOKS = (
+    'write_reg',
+    'write_pred',
+    'write_cond',
+    'write_mem',
+    'write_uart',
+    'write_pin',
+    'redirect',
+)
+
+
+# Get a hook of the callback if it's overridden from the base Callback, or None
+# if it's left as the default so the event can be skipped entirely.
+def subscribed(cb, name):
+    if getattr(type(cb), name) is getattr(Callback, name):
+        return None
+
+    return getattr(cb, name)
+
+
+# Flat memory holding all 64K 16b words, with a bitmap tracking which words
+# have been initialised so that reads of anything else can be caught.
+class Memory:
+    SIZE = 1 << 16
+
+    def __init__(self, path=None):
+        self.words = array('H', [0]) * self.SIZE
+        self.vld = bytearray(self.SIZE // 8)
+
+        # Number of words loaded from the image.
+        self.loaded = 0
+
+        if path is not None:
+            self.load(path)
+
+    # Load a binary image of big-endian 16b words to the start of memory. The
+    # file is read straight into the backing array then swapped in place if
+    # required.
+    def load(self, path):
+        with open(path, 'rb') as f:
+            size = f.readinto(memoryview(self.words).cast('B'))
+
+        if size % 2:
+            raise Exception(f'Image is not a multiple of 16b: {path}')
+
+        size //= 2
+        if sys.byteorder == 'little':
+            view = self.words[:size]
+            view.byteswap()
+            self.words[:size] = view
+
+        # Mark whole bytes of the bitmap first, then any remaining words.
+        self.vld[:size // 8] = b'\xff' * (size // 8)
+        for addr in range(size & ~7, size):
+            self.vld[addr >> 3] |= 1 << (addr & 7)
+
+        self.loaded = size
+
+    # Contents of the loaded image as big-endian bytes.
+    def image(self):
+        words = self.words[:self.loaded]
+        if sys.byteorder == 'little':
+            words.byteswap()
+
+        return words.tobytes()
+
+    # Independent copy of the memory, for snapshots.
+    def copy(self):
+        mem = Memory()
+        mem.words[:] = self.words
+        mem.vld[:] = self.vld
+        mem.loaded = self.loaded
+        return mem
+
+    # Initialised words as big-endian bytes, one range after another.
+    def ranges_image(self, ranges):
+        words = array('H')
+        for start, length in ranges:
+            words.extend(self.words[start:start + length])
+
+        if sys.byteorder == 'little':
+            words.byteswap()
+
+        return words.tobytes()
+
+    # Load ranges of big-endian words written by ranges_image().
+    def load_ranges(self, ranges, data):
+        words = array('H', data)
+        if sys.byteorder == 'little':
+            words.byteswap()
+
+        if len(words) != sum(length for _, length in ranges):
+            raise Exception('Memory image does not match its ranges')
+
+        pos = 0
+        for start, length in ranges:
+            for addr in range(start, start + length):
+                self.write(addr, words[pos])
+                pos += 1
+
+    # Ranges of initialised words as a list of (start, length).
+    def ranges(self):
+        ranges = []
+        start = None
+
+        for addr in range(self.SIZE + 1):
+            vld = addr < self.SIZE and addr in self
+            if vld and start is None:
+                start = addr
+            elif not vld and start is not None:
+                ranges.append((start, addr - start))
+                start = None
+
+        return ranges
+
+    # Check whether a word has been initialised.
+    def __contains__(self, addr):
+        return addr < self.SIZE and (self.vld[addr >> 3] >> (addr & 7)) & 1
+
+    def read(self, addr):
+        if addr not in self:
+            raise Exception(f'Read from uninitialised memory: 0x{addr:04x}')
+
+        return self.words[addr]
+
+    def write(self, addr, value):
+        self.words[addr] = value
+        self.vld[addr >> 3] |= 1 << (addr & 7)
+
+    # Get the bytes for the instruction at PC, including the next 16b if it
+    # exists in case the instruction takes an immediate.
+    def fetch(self, pc):
+        if pc not in self:
+            raise Exception(f'Fetch from uninitialised memory: 0x{pc:04x}')
+
+        nxt = (pc + 1) & 0xffff
+        if nxt in self:
+            return struct.pack('>HH', self.words[pc], self.words[nxt])
+
+        return struct.pack('>H', self.words[pc])
+
+
+# End of test is signalled by sending the string @@END@@ over UART followed by
+# the exit code of test_main.
+END_OF_TEST = [ord(x) for x in '@@END@@']
+
+# Reasons for Sim.run() returning.
+STOP_MAX_TICKS = 'max_ticks'
+STOP_END_OF_TEST = 'end_of_test'
+STOP_BREAKPOINT = 'breakpoint'
+STOP_PIN = 'pin'
 
-# Behavioural simulator of the core. Not cycle accurate.
+
+# Conditions for stopping Sim.run(). Each is identified by the reason that is
+# returned when it's met.
+
+# Stop once the end of test marker and exit code have been sent over UART.
+class EndOfTest:
+    reason = STOP_END_OF_TEST
+
+
+# Stop when the PC reaches an address, before running the instruction there.
+class Breakpoint:
+    reason = STOP_BREAKPOINT
+
+    def __init__(self, pc):
+        self.pc = pc
+
+
+# Stop once an output pin is written, optionally only when written with a
+# specific value.
+class PinEvent:
+    reason = STOP_PIN
+
+    def __init__(self, pin, value=None):
+        self.pin = pin
+        self.value = value
+
+
+# Result of a call to Sim.run(). Ticks and UART data only cover that call.
+class RunResult:
+    def __init__(self, reason, ticks, pc, uart_tx, exit_code):
+        self.reason = reason
+        self.ticks = ticks
+        self.pc = pc
+        self.uart_tx = uart_tx
+        self.exit_code = exit_code
+
+
+# Stop conditions for a call to run(), checked as UART and pin writes are made.
+# Shared by both backends. Each check returns True once the run should stop,
+# after the current instruction has completed.
+class Watch:
+    def __init__(self, stop_on, uart_tail):
+        self.end_of_test = False
+        self.breaks = set()
+        self.pins = {}
+
+        for stop in stop_on:
+            reason = getattr(stop, 'reason', None)
+
+            if reason == STOP_END_OF_TEST:
+                self.end_of_test = True
+            elif reason == STOP_BREAKPOINT:
+                self.breaks.add(stop.pc & 0xffff)
+            elif reason == STOP_PIN:
+                self.pins[stop.pin] = stop.value
+            else:
+                raise Exception(f'Unknown stop condition: {stop}')
+
+        # Last values sent over UART, kept by the simulator across runs so the
+        # end of test marker can be split between them.
+        self.uart_tail = uart_tail
+
+        self.uart_tx = []
+        self.reason = None
+        self.exit_code = None
+
+    def write_uart(self, value):
+        self.uart_tx.append(value)
+        self.uart_tail.append(value)
+
+        if self.end_of_test and list(self.uart_tail)[:-1] == END_OF_TEST:
+            self.reason = STOP_END_OF_TEST
+            self.exit_code = value
+
+        return self.reason is not None
+
+    def write_pin(self, pin, value):
+        if pin in self.pins and self.pins[pin] in (None, value):
+            self.reason = STOP_PIN
+
+        return self.reason is not None
+
+    def result(self, ticks, pc):
+        return RunResult(
+            self.reason or STOP_MAX_TICKS,
+            ticks,
+            pc,
+            self.uart_tx,
+            self.exit_code,
+        )
+
+
+# Approximate timing model of the RTL, counting 4 GCK periods in the same way
+# the core does. Each instruction takes a period per 16b fetched, with extra
+# periods for the SQI memories to be redirected and for UART stalls. This
+# doesn't model everything the RTL does, so run "timing.py" against RTL results
+# to check how close it is.
+class Timing:
+    # GCK cycles per period, in which one 16b word is transferred from memory
+    # and one instruction is run.
+    PERIOD = 4
+
+    # Periods from reset until the first instruction is fetched. This is the
+    # same as a redirect as the memories start from address zero.
+    RESET = 6
+
+    # Periods to redirect the memories: CS high, READ/WRITE instruction, two
+    # periods of address, the dummy byte, then the first data.
+    REDIRECT = 6
+
+    # Periods the UART TX is busy sending 16b once it's been accepted.
+    UTX_BUSY = 6
+
+    # Periods the UART RX stalls waiting for 16b to be sent in once the core
+    # requests it.
+    URX_WAIT = 5
+
+    # Load and store instructions, which redirect the memories to the address
+    # then back again to the PC afterwards.
+    MEM = set([
+        'ld',
+        'st',
+        'ld+',
+        'st+',
+        '+ld',
+        '+st',
+        'ld-',
+        'st-',
+        '-ld',
+        '-st',
+        'ldm',
+        'stm',
+    ])
+
+    def __init__(self):
+        self.periods = self.RESET
+
+        # Period that the UART TX will next accept data.
+        self.utx_free = 0
+
+    # Cycles taken so far, including any UART data still being sent.
+    @property
+    def cycles(self):
+        return max(self.periods, self.utx_free) * self.PERIOD
+
+    # Account for an instruction, given whether it ran or was skipped because
+    # of the cond state and whether it redirected the PC.
+    def tick(self, instr, ran, redirect):
+        periods = 1 + ('imm' in instr.ops)
+
+        if ran:
+            mnem = instr.mnem
+
+            # Memory operations transfer one register per period, with stores
+            # taking an extra period to finish the final write.
+            if mnem in self.MEM:
+                ops = instr.ops
+                regs = ((ops['s'] - ops['r']) & 15) + 1 if 'r' in ops else 1
+                periods += 2 * self.REDIRECT + regs + ('st' in mnem)
+            elif redirect:
+                periods += self.REDIRECT
+
+            # UART TX stalls until the previous data has been sent.
+            if mnem == 'utx':
+                periods += max(0, self.utx_free - self.periods)
+                self.utx_free = self.periods + periods + self.UTX_BUSY
+            elif mnem == 'urx':
+                periods += self.URX_WAIT
+
+        self.periods += periods
+
+
+# Instructions that can use the carry from the previous instruction.
+CARRY_VLD = set(['add', 'sub', 'sra', 'srl'])
+
+# Instructions that end a basic block. These either redirect the PC, set cond
+# state that changes whether following instructions run, or write UART or pins
+# which may be a condition for stopping run().
+BLOCK_END = set([
+    'b',
+    'j',
+    'bl',
+    'jl',
+    'eqx',
+    'nex',
+    'ltx',
+    'ltux',
+    'gex',
+    'geux',
+    'anyx',
+    'inpx',
+    'cex',
+    'utx',
+    'out',
+    'outn',
+    'outp',
+])
+
+# Maximum number of instructions in a basic block.
+BLOCK_MAX = 64
+
+
+# Sequence of instructions translated for running in one go. Each entry holds
+# the PC to set while the instruction runs, the next sequential PC, the handler
+# with operands bound, and whether the carry is valid after the instruction.
+class Block:
+    def __init__(self):
+        self.entries = []
+        self.addrs = []
+
+        # Cleared when memory in the block is written.
+        self.valid = True
+
+
+# Behavioural simulator of the core. Not cycle accurate. This is the reference
+# implementation, but a faster native backend implementing the same model can
+# be selected with backend='native'.
 class Sim:
-    def __init__(self, cb=Callback(), verbose=False):
+    def __new__(cls, cb=Callback(), verbose=False, backend='python',
+                timing=False, profile=None):
+        if backend == 'native':
+            if timing:
+                raise Exception('Timing is not supported by native backend')
+
+            if profile:
+                raise Exception('Profiling is not supported by native backend')
+
+            import native
+            return native.Sim(cb, verbose)
+
+        if backend != 'python':
+            raise Exception(f'Unknown simulator backend: {backend}')
+
+        return super().__new__(cls)
+
+    def __init__(self, cb=Callback(), verbose=False, backend='python',
+                 timing=False, profile=None):
         self.cb = cb
         self.verbose = verbose
 
+        # Hooks the callback subscribes to, with None for any left as the
+        # default so nothing is called for events it ignores.
+        for name in OPTIONAL_HOOKS:
+            setattr(self, f'on_{name}', subscribed(cb, name))
+
+        # Optional model of RTL timing, and profiler which is told about every
+        # instruction that's run.
+        self.timing = Timing() if timing else None
+        self.profile = profile
+
         # Program counter resets to zero.
         self.pc = 0
 
@@ -86,6 +496,22 @@ class Sim:
         # Output pins.
         self.out_pins = [None] * 4
 
+        # Decoded instructions indexed by PC so repeated fetches of the same
+        # address don't need to go back through the decoder. Entries are
+        # dropped when memory they were decoded from is written.
+        self.icache = {}
+
+        # Translated basic blocks indexed by starting PC, and the blocks using
+        # each address so they can be dropped when it is written.
+        self.blocks = {}
+        self.block_addrs = {}
+
+        # Stop conditions for the current call to run(), breakpoints that
+        # blocks are split at, and the last values sent over UART.
+        self.watch = None
+        self.breaks = set()
+        self.uart_tail = collections.deque(maxlen=len(END_OF_TEST) + 1)
+
         # Functions for running each instruction type.
         self.funcs = {
             'add':      self._add_sub,
@@ -148,10 +574,50 @@ class Sim:
             'cex':      self._cex,
         }
 
+    # Architectural state as plain values, for Snapshot.
+    def snapshot(self):
+        return {
+            'ticks': self.ticks,
+            'pc': self.pc,
+            'regs': list(self.regs),
+            'pred': self.pred,
+            'cond': self.cond,
+            'count_op': self.count_op,
+            'num_count': self.num_count,
+            'max_count': self.max_count,
+            'cin': self.cin,
+            'out_pins': list(self.out_pins),
+            'uart_tail': list(self.uart_tail),
+        }
+
+    # Restore architectural state from snapshot(). Decoded instructions and
+    # blocks are dropped as memory may no longer match them. Timing and
+    # profiling aren't part of the snapshot so carry on from where they are.
+    def restore(self, state):
+        self.ticks = state['ticks']
+        self.pc = state['pc']
+        self.regs = list(state['regs'])
+        self.pred = bool(state['pred'])
+        self.cond = state['cond']
+        self.count_op = state['count_op']
+        self.num_count = state['num_count']
+        self.max_count = state['max_count']
+        self.cin = state['cin']
+        self.out_pins = list(state['out_pins'])
+
+        self.uart_tail.clear()
+        self.uart_tail.extend(state['uart_tail'])
+
+        self.icache.clear()
+        self.blocks.clear()
+        self.block_addrs.clear()
+
     # Run a single instruction. If an instruction is passed in this will be
-    # executed and no fetch will be performed.
+    # executed and no fetch will be performed. Returns the instruction that was
+    # run.
     def tick(self, instr=None):
         redirect = None
+        start = self.pc
 
         # Fetch instruction and get the next sequential PC, then increment the
         # PC if the instruction has an immediate to account for it being
@@ -164,22 +630,27 @@ class Sim:
 
         # Check if the instruction should run based on the predicate register
         # and cond state, and if so execute the instruction.
-        if self._check_run():
+        run = self._check_run()
+        if run:
             # Special case for CEX as we want the actual value rather than the
             # number of predicated followers which is used returned by the
-            # decoder in the operand.
+            # decoder in the operand. Copy rather than modify in place as the
+            # instruction may be cached and run again.
             ops = instr.ops
             if instr.mnem == 'cex':
-                ops['m'] = instr.cex_mask
+                ops = dict(ops, m=instr.cex_mask)
 
             redirect = self.funcs[instr.mnem](instr.mnem, **ops)
 
         # If the instruction redirected the PC update it to the new address,
         # otherwise continue sequentially.
         if redirect:
-            self._log(f'BRANCH 0x{redirect:04x}')
+            if self.verbose:
+                self._log(f'BRANCH 0x{redirect:04x}')
+
             self.pc = redirect
-            self.cb.redirect(redirect, pc)
+            if self.on_redirect:
+                self.on_redirect(redirect, pc)
         else:
             self.pc = pc
 
@@ -191,22 +662,177 @@ class Sim:
             self.count_op = None
 
         # Clear carry if persistence isn't set.
-        CARRY_VLD = set(['add', 'sub', 'sra', 'srl'])
         if self.count_op != 'carry' or instr.mnem not in CARRY_VLD:
             self.cin = 0
 
         # Increment tick counter for logging.
         self.ticks += 1
 
+        if self.timing:
+            self.timing.tick(instr, run, redirect)
+
+        if self.profile:
+            self.profile.tick(start, instr, run, redirect, self.timing)
+
+        return instr
+
+    # Run instructions up to the end of the basic block at the current PC,
+    # limited to at most max_ticks. Behaves the same as calling tick() for each
+    # instruction but avoids fetching and dispatching every time. Returns the
+    # number of instructions that were run.
+    def tick_block(self, max_ticks=None):
+        block = None
+
+        # Tracing, timing, and profiling are only supported when running
+        # instructions one at a time.
+        if not (self.verbose or self.timing or self.profile):
+            block = self.blocks.get(self.pc) or self._translate(self.pc)
+
+        if not block:
+            self.tick()
+            return 1
+
+        ticks = 0
+        on_redirect = self.on_redirect
+
+        for pc, next_pc, func, carry_vld in block.entries:
+            if max_ticks is not None and ticks >= max_ticks:
+                break
+
+            redirect = None
+            self.pc = pc
+
+            if self._check_run():
+                redirect = func()
+
+            if redirect:
+                self.pc = redirect
+                if on_redirect:
+                    on_redirect(redirect, next_pc)
+            else:
+                self.pc = next_pc
+
+            if self.num_count < self.max_count:
+                self.num_count += 1
+            if self.num_count >= self.max_count:
+                self.count_op = None
+
+            if self.count_op != 'carry' or not carry_vld:
+                self.cin = 0
+
+            self.ticks += 1
+            ticks += 1
+
+            # Stop if the instruction wrote to memory in the block as the rest
+            # of it may no longer be correct.
+            if not block.valid:
+                break
+
+        return ticks
+
+    # Run for up to max_ticks instructions or until one of the conditions in
+    # stop_on is met, returning a RunResult. A breakpoint at the current PC is
+    # ignored so that a run can resume from one.
+    def run(self, max_ticks, stop_on=()):
+        watch = Watch(stop_on, self.uart_tail)
+
+        # Blocks must not run past a breakpoint, so retranslate when they
+        # change.
+        if watch.breaks != self.breaks:
+            self.breaks = watch.breaks
+            self.blocks = {}
+            self.block_addrs = {}
+
+        start = self.ticks
+        self.watch = watch
+
+        try:
+            while self.ticks - start < max_ticks:
+                if self.pc in self.breaks and self.ticks != start:
+                    watch.reason = STOP_BREAKPOINT
+                    break
+
+                self.tick_block(max_ticks - (self.ticks - start))
+
+                if watch.reason:
+                    break
+        finally:
+            self.watch = None
+
+        return watch.result(self.ticks - start, self.pc)
+
+    # Translate the basic block starting at PC. Returns None if not even the
+    # first instruction could be translated, in which case it should be run
+    # through tick() to report the error.
+    def _translate(self, pc):
+        block = Block()
+
+        while len(block.entries) < BLOCK_MAX:
+            # Stop before anything that can't be fetched or decoded so that
+            # errors are reported when the instruction is actually reached.
+            try:
+                instr = self._decode(pc)
+            except Exception:
+                break
+
+            if instr.mnem is None:
+                break
+
+            if block.entries and pc in self.breaks:
+                break
+
+            ops = instr.ops
+            if instr.mnem == 'cex':
+                ops = dict(ops, m=instr.cex_mask)
+
+            func = functools.partial(self.funcs[instr.mnem], instr.mnem, **ops)
+            size = instr.size()
+
+            block.entries.append((
+                pc + size - 1,
+                pc + size,
+                func,
+                instr.mnem in CARRY_VLD,
+            ))
+            block.addrs += [(pc + i) & 0xffff for i in range(size)]
+
+            pc += size
+            if instr.mnem in BLOCK_END or pc > 0xffff:
+                break
+
+        if not block.entries:
+            return None
+
+        start = block.addrs[0]
+        self.blocks[start] = block
+        for addr in block.addrs:
+            self.block_addrs.setdefault(addr, set()).add(start)
+
+        return block
+
+    # Get the decoded instruction at PC, going through the cache.
+    def _decode(self, pc):
+        instr = self.icache.get(pc)
+        if instr is None:
+            instr = self.cb.fetch(pc)
+            self.icache[pc] = instr
+
+        return instr
+
     # Fetch the next instruction, returning its value and the next PC.
     def _fetch(self, pc):
-        instr = self.cb.fetch(pc)
+        instr = self._decode(pc)
 
-        # Add cond based on current state for tracing.
+        # Add cond based on current state for tracing. Always set as a cached
+        # instruction may have been run with a different cond state before.
         if self.cond not in (0, 1):
             instr.cond = '.t' if self.cond & 1 else '.f'
+        else:
+            instr.cond = None
+
+        if self.verbose:
+            self._log(f'RUN    0x{self.pc:04x}    {instr}')
 
-        self._log(f'RUN    0x{self.pc:04x}    {instr}')
         return instr, pc + instr.size()
 
     # Check for whether the next instruction should run.
@@ -225,7 +851,7 @@ class Sim:
         # Shift out the now consumed bit of the cond state.
         self.cond >>= 1
 
-        if not run:
+        if not run and self.verbose:
             cond = 'T' if cond else 'F'
             pred = 'T' if self.pred else 'F'
             self._log(f'SKIP   {cond}         {pred}')
@@ -237,9 +863,12 @@ class Sim:
         if not reg:
             return
 
-        self._log(f'REG    {isa.REGS_INV[reg]:3}       0x{value:04x}')
+        if self.verbose:
+            self._log(f'REG    {isa.REGS_INV[reg]:3}       0x{value:04x}')
+
         self.regs[reg] = value
-        self.cb.write_reg(reg, value)
+        if self.on_write_reg:
+            self.on_write_reg(reg, value)
 
     # Write the predicate register.
     def _write_pred(self, value):
@@ -248,24 +877,51 @@ class Sim:
         elif self.count_op == 'or':
             value = self.pred or value
 
-        self._log(f'PRED   {int(value)}')
+        if self.verbose:
+            self._log(f'PRED   {int(value)}')
+
         self.pred = bool(value)
-        self.cb.write_pred(value)
+        if self.on_write_pred:
+            self.on_write_pred(value)
 
     # Write cond state.
     def _write_cond(self, value):
-        value_str = bin(value)[3:].replace('1', 'T').replace('0', 'F')[::-1]
-        self._log(f'COND   {value_str}')
+        if self.verbose:
+            conds = bin(value)[3:].replace('1', 'T').replace('0', 'F')[::-1]
+            self._log(f'COND   {conds}')
+
         self.cond = value
-        self.cb.write_cond(value)
+        if self.on_write_cond:
+            self.on_write_cond(value)
+
+    # Write memory, dropping any cached instructions or blocks that were
+    # decoded from the address. This includes the instruction before as the
+    # address may hold its immediate.
+    def _write_mem(self, addr, value):
+        self.icache.pop(addr, None)
+        self.icache.pop((addr - 1) & 0xffff, None)
+
+        for start in self.block_addrs.pop(addr, ()):
+            if block := self.blocks.pop(start, None):
+                block.valid = False
+
+        if self.on_write_mem:
+            self.on_write_mem(addr, value)
 
     # Write output pin.
     def _write_out_pin(self, pin, value):
-        self._log(f'OUT    {pin:1}         0x{value:x}')
+        if self.verbose:
+            self._log(f'OUT    {pin:1}         0x{value:x}')
+
         self.out_pins[pin] = value
-        self.cb.write_pin(pin, value)
+        if self.on_write_pin:
+            self.on_write_pin(pin, value)
 
-    # Log if verbose is enabled.
+        if self.watch:
+            self.watch.write_pin(pin, value)
+
+    # Log if verbose is enabled. Call sites in the model check verbose first so
+    # that messages aren't formatted when tracing is off.
     def _log(self, *args):
         if self.verbose:
             print(f'{self.ticks:6d} ', end='')
@@ -346,14 +1002,22 @@ class Sim:
         value = self.regs[c] if c != isa.REGS['sp'] else imm
         value &= 0xffff
 
-        self._log(f'UTX    0x{value:04x}')
-        self.cb.write_uart(value)
+        if self.verbose:
+            self._log(f'UTX    0x{value:04x}')
+
+        if self.on_write_uart:
+            self.on_write_uart(value)
+
+        if self.watch:
+            self.watch.write_uart(value)
 
     # UART RX.
     def _urx(self, mnem, a=None):
         value = self.cb.read_uart() & 0xffff
 
-        self._log(f'URX    0x{value:04x}')
+        if self.verbose:
+            self._log(f'URX    0x{value:04x}')
+
         self._write_reg(a, value)
 
     # Cond state configuration instruction.
@@ -388,8 +1052,10 @@ class Sim:
         # Store to memory - read data after address update in case base is the
         # value being stored.
         data = self.regs[a]
-        self._log(f'ST     0x{addr:04x}    0x{data:04x}')
-        self.cb.write_mem(addr, data)
+        if self.verbose:
+            self._log(f'ST     0x{addr:04x}    0x{data:04x}')
+
+        self._write_mem(addr, data)
 
     # Load from memory - same as store but read data instead.
     def _ld(self, mnem, a=None, b=None, c=None, imm=None):
@@ -408,7 +1074,8 @@ class Sim:
             self._write_reg(b, final_addr)
 
         data = self.cb.read_mem(addr)
-        self._log(f'LD     0x{addr:04x}    0x{data:04x}')
+        if self.verbose:
+            self._log(f'LD     0x{addr:04x}    0x{data:04x}')
 
         # Store load value after writeback in case A == B.
         self._write_reg(a, data)
@@ -420,11 +1087,15 @@ class Sim:
         while True:
             if 'st' in mnem:
                 data = self.regs[r]
-                self._log(f'ST     0x{addr:04x}    0x{data:04x}')
-                self.cb.write_mem(addr, data)
+                if self.verbose:
+                    self._log(f'ST     0x{addr:04x}    0x{data:04x}')
+
+                self._write_mem(addr, data)
             else:
                 data = self.cb.read_mem(addr)
-                self._log(f'LD     0x{addr:04x}    0x{data:04x}')
+                if self.verbose:
+                    self._log(f'LD     0x{addr:04x}    0x{data:04x}')
+
                 self._write_reg(r, data)
 
             # Check if this is the final register and if not keep going.
@@ -498,7 +1169,8 @@ class Sim:
         self.count_op = 'carry'
         self.cin = 0
 
-        self._log(f'COUNT  {self.count_op:4}      {self.max_count}')
+        if self.verbose:
+            self._log(f'COUNT  {self.count_op:4}      {self.max_count}')
 
     # Update AND/OR state for P.
     def _andor_p(self, mnem, j=None):
@@ -506,7 +1178,8 @@ class Sim:
         self.max_count = j
         self.count_op = mnem[:-1]
 
-        self._log(f'COUNT  {self.count_op:4}      {self.max_count}')
+        if self.verbose:
+            self._log(f'COUNT  {self.count_op:4}      {self.max_count}')
 
     # Bitwise NOT.
     def _not(self, mnem, a=None, b=None):
@@ -540,7 +1213,8 @@ class Sim:
     # Read input pin.
     def _in(self, mnem, n=None, a=None):
         value = self.cb.read_pin(n) & 1
-        self._log(f'IN     {n:1}         0x{value:x}')
+        if self.verbose:
+            self._log(f'IN     {n:1}         0x{value:x}')
 
         if mnem == 'in':
             self._write_reg(a, value)
@@ -553,6 +1227,367 @@ class Sim:
             raise NotImplementedError()
 
 
+# Callback for running a test binary on its own, with memory loaded from the
+# binary and UART and pins driven from the test's YAML config. UART input is
+# read through a stim.Words cursor.
+class TestCallback(Callback):
+    def __init__(self, path, uart_rx):
+        self.mem = Memory(path)
+        self.uart_tx = []
+        self.uart_rx = uart_rx
+        self.pins = [None] * 4
+
+    # Number of UART values read by the test.
+    @property
+    def uart_rx_used(self):
+        return self.uart_rx.pos
+
+    # Memory, UART, and pin state for Snapshot. The memory is copied so the
+    # snapshot is unaffected by the run carrying on. Only the position in the
+    # UART input is kept, as it's restored into a callback for the same test.
+    def snapshot(self):
+        return {
+            'mem': self.mem.copy(),
+            'uart_tx': list(self.uart_tx),
+            'uart_rx_used': self.uart_rx_used,
+            'in_pins': list(self.pins),
+        }
+
+    # Restore state from snapshot() into a new callback for the same test.
+    def restore(self, state):
+        self.mem = state['mem'].copy()
+        self.uart_tx = list(state['uart_tx'])
+        self.uart_rx.seek(state['uart_rx_used'])
+        self.pins = list(state['in_pins'])
+
+    # Initial memory contents for the native backend.
+    def image(self):
+        return self.mem.image()
+
+    # Fetch and decode instruction from memory.
+    def fetch(self, pc):
+        return decode(self.mem.fetch(pc), max_items=1)[0]
+
+    # UART IO.
+    def write_uart(self, value):
+        self.uart_tx.append(value)
+
+    def read_uart(self):
+        if not self.uart_rx:
+            raise Exception(f'No data in UART RX buffer')
+
+        return self.uart_rx.popleft()
+
+    # Memory accesses.
+    def write_mem(self, addr, value):
+        self.mem.write(addr, value)
+
+    def read_mem(self, addr):
+        return self.mem.read(addr)
+
+    # Input pins.
+    def read_pin(self, pin):
+        return self.pins[pin]
+
+
+# Snapshot of a simulator and the TestCallback it's running with. A snapshot
+# can be restored into any number of new simulators on either backend to
+# resume a run, or fork several runs from one warmed up state, without running
+# everything before it again.
+#
+# On disk the state is written as YAML, which the native RTL bench can also
+# read, with the initialised ranges of memory written alongside it as
+# big-endian 16b words with a .bin suffix. Uninitialised registers and pins are
+# written as -1.
+class Snapshot:
+    def __init__(self, state, cb_state):
+        self.state = state
+        self.cb_state = cb_state
+
+    # Take a snapshot of the current state.
+    @classmethod
+    def take(cls, sim, cb):
+        return cls(sim.snapshot(), cb.snapshot())
+
+    # Restore the snapshot. The callback goes first as the native backend
+    # reloads its memory from it.
+    def restore(self, sim, cb):
+        cb.restore(self.cb_state)
+        sim.restore(self.state)
+
+    # Path of the memory image for a snapshot.
+    @staticmethod
+    def _image_path(path):
+        path = pathlib.Path(path)
+        return path.with_name(path.name + '.bin')
+
+    def save(self, path):
+        mem = self.cb_state['mem']
+        ranges = mem.ranges()
+
+        def ints(values):
+            return [-1 if x is None else int(x) for x in values]
+
+        state = dict(self.state, **self.cb_state)
+        state.update({
+            'regs': ints(state['regs']),
+            'pred': int(state['pred']),
+            'out_pins': ints(state['out_pins']),
+            'in_pins': ints(state['in_pins']),
+            'mem': [x for r in ranges for x in r],
+        })
+
+        with open(path, 'w') as f:
+            yaml.safe_dump(
+                state,
+                f,
+                default_flow_style=None,
+                sort_keys=False,
+                width=float('inf'),
+            )
+
+        with open(self._image_path(path), 'wb') as f:
+            f.write(mem.ranges_image(ranges))
+
+    @classmethod
+    def load(cls, path):
+        with open(path, 'r') as f:
+            state = yaml.safe_load(f)
+
+        def opts(values):
+            return [None if x < 0 else x for x in values]
+
+        ranges = list(zip(state['mem'][0::2], state['mem'][1::2]))
+
+        mem = Memory()
+        with open(cls._image_path(path), 'rb') as f:
+            mem.load_ranges(ranges, f.read())
+
+        cb_state = {
+            'mem': mem,
+            'uart_tx': state['uart_tx'],
+            'uart_rx_used': state['uart_rx_used'],
+            'in_pins': opts(state['in_pins']),
+        }
+
+        sim_state = {
+            k: state[k] for k in state if k not in cb_state and k != 'mem'
+        }
+        sim_state['regs'] = opts(sim_state['regs'])
+        sim_state['out_pins'] = opts(sim_state['out_pins'])
+
+        return cls(sim_state, cb_state)
+
+
+# Checkpoint of the architectural state taken once the PC reaches an address
+# or a number of instructions have run, for warm starting the native RTL bench
+# part way through a test. The state is written as YAML to the path, and the
+# memory image alongside it as with Snapshot.
+class Checkpoint:
+    def __init__(self, path, pc=None, tick=None):
+        if (pc is None) == (tick is None):
+            raise Exception('Checkpoint needs exactly one of a PC or tick')
+
+        self.path = pathlib.Path(path)
+        self.pc = pc
+        self.tick = tick
+        self.done = False
+
+    # Whether the simulator has reached the checkpoint.
+    def reached(self, sim):
+        if self.pc is not None:
+            return sim.pc == self.pc
+
+        return sim.ticks >= self.tick
+
+    # Write a snapshot of the simulator and callback to the path.
+    def write(self, sim, cb):
+        Snapshot.take(sim, cb).save(self.path)
+        sim._log(f'CKPT   0x{sim.pc:04x}    {self.path}')
+
+        self.done = True
+
+
+# Instruction count of the first check for a test making no progress, with the
+# count doubling for each check after, and the number of instructions each
+# check compares against the state it started from.
+HANG_START = 10000
+HANG_STEPS = 1024
+
+
+# Detection of a test that can no longer make progress, so that it fails
+# straight away with a diagnostic rather than running until the timeout. The
+# models are deterministic, so once the architectural state, memory, and UART
+# and pin positions repeat exactly it will loop forever, as long as there are
+# no input pin events still to come. Catches self-branches such as the idle
+# loop in the test wrapper, and any longer cycle that doesn't change state.
+#
+# To keep the cost down the state is only compared during a check, when the
+# state before an instruction is kept and compared against the state after each
+# of the next HANG_STEPS instructions. State is given as functions so that it's
+# only gathered when the PC matches, with memory last as it's most costly.
+class HangCheck:
+    def __init__(self, start=HANG_START, steps=HANG_STEPS):
+        self.next = start
+        self.steps = steps
+
+        # Tick, PC, and state at the start of the check in progress.
+        self.start = None
+        self.pc = None
+        self.state = None
+        self.mem = None
+
+    # Whether a check is in progress, requiring instructions to be stepped.
+    def active(self):
+        return self.start is not None
+
+    # Called after each instruction during a check, or once the tick of the
+    # next check is reached, raising if the state has repeated.
+    def step(self, ticks, pc, state, mem):
+        if self.start is None:
+            if ticks >= self.next:
+                self.start = ticks
+                self.pc = pc
+                self.state = state()
+                self.mem = mem()
+            return
+
+        if pc == self.pc and state() == self.state and mem() == self.mem:
+            period = ticks - self.start
+            what = 'branch to self' if period == 1 else 'no state change'
+            raise Exception(
+                f'Hang at 0x{pc:04x}: {what}, repeating every {period} '
+                f'instructions from tick {self.start}'
+            )
+
+        if ticks - self.start >= self.steps:
+            self.start = None
+            self.next = max(self.next * 2, ticks + 1)
+
+    # Give up on any check in progress, e.g. while the test may be waiting on
+    # input pin events.
+    def reset(self, ticks):
+        self.start = None
+        self.next = max(self.next, ticks + 1)
+
+
+# Architectural state of a simulator for HangCheck, leaving out the tick count
+# and UART tail which change or are covered by the UART position.
+def hang_state(sim):
+    state = sim.snapshot()
+    return (
+        state['pc'],
+        tuple(state['regs']),
+        state['pred'],
+        state['cond'],
+        state['count_op'],
+        state['num_count'],
+        state['max_count'],
+        state['cin'],
+        tuple(state['out_pins']),
+    )
+
+
+# Run a test binary until it signals the end of test, raising if it times out,
+# hangs, exits with a non-zero code, or sends the wrong data over UART. Returns
+# the simulator so callers can inspect the final state. If a checkpoint is given
+# it's written once reached and the test carries on to the end, and if a
+# snapshot is given the test resumes from it rather than starting from reset.
+def run_test(path, config, timeout, verbose=False, backend='python',
+             timing=False, profile=None, checkpoint=None, resume=None):
+    config = config or {}
+
+    # UART input and pin events are consumed as the test runs.
+    uart_rx = stim.uart_input(config)
+    input_pin = stim.pin_events(config)
+
+    exit_code = None
+
+    cb = TestCallback(path, uart_rx)
+    sim = Sim(cb, verbose, backend, timing, profile)
+
+    # Pin events from before the snapshot are applied again below, leaving
+    # the pins as they were when it was taken.
+    if resume:
+        resume.restore(sim, cb)
+
+    hang = HangCheck(sim.ticks + HANG_START)
+    hang_cb = lambda: (len(cb.uart_tx), cb.uart_rx_used, tuple(cb.pins))
+    hang_mem = lambda: bytes(cb.mem.words)
+
+    while sim.ticks < timeout:
+        # A run never stops at a breakpoint on the PC it starts from, so the
+        # checkpoint is checked here before each run rather than from why the
+        # last one stopped. Runs stop at pin events and chunk boundaries, and
+        # step one instruction at a time while checking for a hang, and any of
+        # these can land on the checkpoint PC.
+        if checkpoint and not checkpoint.done and checkpoint.reached(sim):
+            checkpoint.write(sim, cb)
+
+        # Update input pins.
+        while input_pin and sim.ticks >= input_pin[0]['time']:
+            pins = input_pin.popleft()['pins']
+            for k, v in pins.items():
+                cb.pins[k] = v
+
+        # Run until the end of test, stopping early at the next pin update or
+        # the timeout.
+        max_ticks = timeout - sim.ticks
+        if input_pin:
+            max_ticks = min(max_ticks, input_pin[0]['time'] - sim.ticks)
+
+        # Also stop at the checkpoint if it's still to be written.
+        stop_on = [EndOfTest()]
+        if checkpoint and not checkpoint.done:
+            if checkpoint.pc is not None:
+                stop_on.append(Breakpoint(checkpoint.pc))
+            else:
+                max_ticks = min(max_ticks, checkpoint.tick - sim.ticks)
+
+        # Instructions are stepped one at a time while checking for a hang,
+        # which is only possible once there are no more pin events.
+        if input_pin:
+            hang.reset(sim.ticks)
+        elif hang.active():
+            max_ticks = 1
+        else:
+            max_ticks = min(max_ticks, hang.next - sim.ticks)
+
+        result = sim.run(max_ticks, stop_on=stop_on)
+
+        if result.reason == STOP_END_OF_TEST:
+            exit_code = result.exit_code
+            break
+
+        if not input_pin:
+            hang.step(
+                sim.ticks,
+                sim.pc,
+                lambda: (hang_state(sim), hang_cb()),
+                hang_mem,
+            )
+
+    if exit_code is None:
+        raise Exception(f'Timed out after {timeout} ticks')
+
+    if checkpoint and not checkpoint.done:
+        raise Exception('Test ended before reaching the checkpoint')
+
+    sim._log(f'EXIT   0x{exit_code:04x}')
+
+    if exit_code:
+        raise Exception(f'Exited with non-zero code: 0x{exit_code:04x}')
+
+    # Check data received over UART matches expected. Values are compared as
+    # unsigned to avoid thinking about signs.
+    if ref := stim.uart_output(config):
+        data = cb.uart_tx[:-len(END_OF_TEST) - 1]
+        if err := stim.compare(ref, data):
+            raise Exception(f'Received data incorrect: {err}')
+
+    return sim
+
+
 # Parse command line arguments.
 def parse_args():
     parser = argparse.ArgumentParser()
@@ -587,122 +1622,109 @@ def parse_args():
         help='YAML config for the test.',
     )
 
-    args = parser.parse_args()
-
-    if not args.input.is_file():
-        raise Exception(f'Bad input file: {args.input}')
-
-    if not args.yaml.is_file():
-        raise Exception(f'Bad YAML file: {args.yaml}')
-
-    with open(args.yaml, 'r') as f:
-        args.yaml = yaml.safe_load(f)
-
-    return args
-
-
-# Run a binary on the simulator.
-if __name__ == '__main__':
-    args = parse_args()
-
-    # UART IO buffers.
-    uart_tx = []
-    uart_rx = [] if not args.yaml else args.yaml.get('input', [])
-
-    # Input pins.
-    input_pin = [] if not args.yaml else args.yaml.get('input_pin', [])
-
-    class Cb(Callback):
-        # Load binary into memory.
-        def __init__(self, path, uart_tx, uart_rx):
-            self.mem = {}
-            self.uart_tx = uart_tx
-            self.uart_rx = uart_rx
-            self.pins = [None] * 4
-
-            with open(path, 'rb') as f:
-                data = f.read()
+    parser.add_argument(
+        '-b',
+        '--backend',
+        default='python',
+        choices=['python', 'native'],
+        help='Simulator implementation to run on.',
+    )
 
-            # Split into 16b chunks.
-            for i in range(len(data) // 2):
-                self.mem[i] = data[i * 2:i * 2 + 2]
+    parser.add_argument(
+        '--timing',
+        action='store_true',
+        help='Estimate the number of cycles the RTL would take.',
+    )
 
-        # Fetch instruction from memory.
-        def fetch(self, pc):
-            data = self.mem.get(pc)
-            if data is None:
-                raise Exception(f'Fetch from uninitialised memory: 0x{pc:04x}')
+    parser.add_argument(
+        '-p',
+        '--profile',
+        type=pathlib.Path,
+        help='Profile the test, writing reports with this path prefix.',
+    )
 
-            # Add on the next 16b if it exists in case this instruction takes an
-            # immediate.
-            data += self.mem.get(pc + 1, b'')
+    parser.add_argument(
+        '-c',
+        '--checkpoint',
+        type=pathlib.Path,
+        help='Path to write a checkpoint to for warm starting the RTL.',
+    )
 
-            # Decode and return the instruction.
-            return decode(data, max_items=1)[0]
+    parser.add_argument(
+        '--checkpoint-pc',
+        type=functools.partial(int, base=0),
+        help='Take the checkpoint when the PC first reaches this address.',
+    )
 
-        # UART IO.
-        def write_uart(self, value):
-            self.uart_tx.append(value)
+    parser.add_argument(
+        '--checkpoint-tick',
+        type=int,
+        help='Take the checkpoint after this many instructions.',
+    )
 
-        def read_uart(self):
-            if not self.uart_rx:
-                raise Exception(f'No data in UART RX buffer')
+    parser.add_argument(
+        '-r',
+        '--resume',
+        type=pathlib.Path,
+        help='Resume the test from a checkpoint rather than from reset.',
+    )
 
-            return self.uart_rx.pop(0)
+    parser.add_argument(
+        '--ticks',
+        type=pathlib.Path,
+        help='Path to write the number of instructions run to.',
+    )
 
-        # Memory accesses.
-        def write_mem(self, addr, value):
-            self.mem[addr] = struct.pack('>H', value)
+    args = parser.parse_args()
 
-        def read_mem(self, addr):
-            if addr not in self.mem:
-                raise Exception(f'Read from uninitialised memory: 0x{addr:04x}')
+    if not args.input.is_file():
+        raise Exception(f'Bad input file: {args.input}')
 
-            return struct.unpack('>H', self.mem[addr])[0]
+    if not args.yaml.is_file():
+        raise Exception(f'Bad YAML file: {args.yaml}')
 
-        # Input pins.
-        def read_pin(self, pin):
-            return self.pins[pin]
+    args.yaml = stim.load(args.yaml)
 
-    # End of test is signalled by receiving the string @@END@@ over UART
-    # followed by the exit code of test_main.
-    end_of_test = [ord(x) for x in '@@END@@']
-    exit_code = None
+    args.resume = args.resume and Snapshot.load(args.resume)
 
-    cb = Cb(args.input, uart_tx, uart_rx)
-    sim = Sim(cb, args.verbose)
+    args.checkpoint = args.checkpoint and Checkpoint(
+        args.checkpoint,
+        args.checkpoint_pc,
+        args.checkpoint_tick,
+    )
 
-    for _ in range(args.timeout):
-        # Update input pins.
-        while input_pin and sim.ticks >= input_pin[0]['time']:
-            pins = input_pin.pop(0)['pins']
-            for k, v in pins.items():
-                cb.pins[k] = v
+    return args
 
-        # Run single tick.
-        sim.tick()
 
-        # Look for the end of test value in the UART buffer followed by the
-        # exit code.
-        if uart_tx[-len(end_of_test) - 1:-1] == end_of_test:
-            exit_code = uart_tx[-1]
-            break
+# Run a binary on the simulator.
+if __name__ == '__main__':
+    args = parse_args()
 
-    if exit_code is None:
-        raise Exception(f'Timed out after {args.timeout} ticks')
+    # Symbols written by the assembler are used to name functions if present.
+    profile = None
+    if args.profile:
+        import prof
+        profile = prof.Profile(prof.load_symbols(args.input))
+
+    sim = run_test(
+        args.input,
+        args.yaml,
+        args.timeout,
+        args.verbose,
+        args.backend,
+        args.timing,
+        profile,
+        args.checkpoint,
+        args.resume,
+    )
 
-    sim._log(f'EXIT   0x{exit_code:04x}')
+    # Instruction count is written next to the test for deriving timeouts.
+    if args.ticks:
+        with open(args.ticks, 'w') as f:
+            f.write(f'{sim.ticks}\n')
 
-    if exit_code:
-        raise Exception(f'Exited with non-zero code: 0x{exit_code:04x}')
+    if args.timing:
+        print(f'Cycles: {sim.timing.cycles}')
 
-    # Check data received over UART matches expected. Convert values to unsigned
-    # for performing comparison to avoid thinking about signs.
-    if args.yaml and args.yaml.get('output'):
-        ref = [x & 0xffff for x in args.yaml['output']]
-        if (data := uart_tx[:-len(end_of_test) - 1]) != ref:
-            raise Exception(
-                f'Received data incorrect:\n'
-                f'  - Expected  {ref}\n'
-                f'  - Received  {data}'
-            )
+    if profile:
+        profile.write(args.profile, args.input)
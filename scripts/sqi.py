@@ -2,37 +2,98 @@
 WRITE = 0x2
 READ = 0x3
 
+# States of the memory. Address, dummy, and data states span multiple cycles
+# with the position within them tracked separately.
+IDLE = 0
+MODE = 1
+ADDR = 2
+DUMMY = 3
+DATA_WRITE = 4
+DATA_READ = 5
+
+# Number of cycles spent in each of the multi-cycle states.
+ADDR_CYCLES = 4
+DUMMY_CYCLES = 2
+
+# Names of the modes for logging.
+MODE_NAMES = {WRITE: 'WRITE', READ: 'READ'}
+
 
 # Cycle-accurate model of the Microchip 23A512/23LC512 when configured in SQI
 # sequential mode. Intended for use with the test bench.
+#
+# Rather than reporting each byte, the memory calls cb(mode, addr, length) with
+# a summary of each transaction when CS is raised. Bytes written so far in a
+# transaction that's still in progress can be reported early with flush(),
+# after which only the remainder is reported when it ends. Logging is also only
+# done per transaction, and only if a logging function is given.
 class Memory:
-    def __init__(self, log=print):
+    def __init__(self, log=None, cb=None):
         # Memory is always 64K bytes.
         self.size = 1 << 16
 
-        # Actual data in the memory. Reset this to None so we can easily detect
-        # accesses to uninitialised data.
-        self.data = [None] * self.size
+        # Actual data in the memory, along with whether each byte has been
+        # initialised so we can easily detect accesses to uninitialised data.
+        self.data = bytearray(self.size)
+        self.vld = bytearray(self.size)
 
         # Address register and wrapping mask for sequential updates.
-        self.addr = None
+        self.addr = 0
         self.addr_mask = self.size - 1
 
-        # Current state and mode of the memory. We start in an undefined state
-        # which will be cleared to reset when chip select is pulled low.
-        self.state = None
+        # Current state and mode of the memory, with the cycle within the
+        # current state. We start idle and wait for chip select to go low.
+        self.state = IDLE
         self.mode = None
+        self.cycle = 0
+
+        # Start address of the current transaction, the number of bytes
+        # transferred, and the number already reported by flush().
+        self.start = 0
+        self.length = 0
+        self.reported = 0
 
-        # Logging function to use for reporting output. Assumed to be able to
-        # take at least a single string argument.
+        # Logging function taking a single string, and transaction callback.
         self.log = log
+        self.cb = cb
+
+        # Handlers for the rising edge of SCK indexed by state.
+        self.rising = [
+            self._rise_idle,
+            self._rise_mode,
+            self._rise_addr,
+            self._rise_dummy,
+            self._rise_write,
+            self._rise_read,
+        ]
 
     # Load data into the memory via the backdoor i.e. immediately without
-    # consuming any simulation time. Typically used for setting the initial
-    # binary before simulation begins.
+    # consuming any simulation time.
     def backdoor_load(self, addr, data):
-        self.log(f'Backdoor load 0x{addr:04x}: 0x{data:02x}')
-        self.data[addr & self.addr_mask] = data & 0xff
+        addr &= self.addr_mask
+        self.data[addr] = data & 0xff
+        self.vld[addr] = 1
+
+    # Load a contiguous block of bytes via the backdoor.
+    def backdoor_load_bytes(self, addr, data):
+        addr &= self.addr_mask
+        if addr + len(data) > self.size:
+            raise Exception(f'Backdoor load out of range: 0x{addr:04x}')
+
+        self.data[addr:addr + len(data)] = data
+        self.vld[addr:addr + len(data)] = b'\x01' * len(data)
+
+    # Report bytes written so far in the current transaction.
+    def flush(self):
+        if self.state != DATA_WRITE or self.length == self.reported:
+            return
+
+        addr = (self.start + self.reported) & self.addr_mask
+        length = self.length - self.reported
+        self.reported = self.length
+
+        if self.cb:
+            self.cb(WRITE, addr, length)
 
     # Called on the rising edge of the clock. The inputs CS and SIO are expected
     # to be 1b and 4b integer values resepectively.
@@ -41,107 +102,132 @@ class Memory:
             raise Exception('CS or SIO not connected!')
 
         # If CS is high then the memory is not currently active so we should
-        # go back to the initial uninitialised state and do nothing else.
+        # end any transaction and go back to the initial state.
         if cs:
-            if self.mode is not None:
-                self.log('Resetting SQI memory.')
-
-            self.addr = None
-            self.state = None
-            self.mode = None
-
+            if self.state != IDLE:
+                self._end()
             return
 
-        # By default return nothing, but if a write was performed then return
-        # the address and value.
-        write = {}
-
-        # CS is low so the memory is active and the next action to take depends
-        # on the current state.
-        if self.state is None:
-            # This is the first cycle out of reset so we expect the incoming
-            # nibble to contain the top 4b of the mode.
-            self.mode = sio & 0xf
-            self.state = 'mode'
-        elif self.state == 'mode':
-            # Now we receive the low 4b of the mode.
-            self.mode = (self.mode << 4) | (sio & 0xf)
-
-            if self.mode == WRITE:
-                self.log('Mode set to WRITE.')
-            elif self.mode == READ:
-                self.log('Mode set to READ.')
-            else:
-                raise Exception(f'Unknown mode: {self.mode}')
-
-            self.state = 'addr0'
-            self.addr = 0
-        elif self.state.startswith('addr'):
-            # A 16b address is sent in 4b chunks over four cycles in big-endian.
-            self.addr = ((self.addr << 4) | (sio & 0xf)) & self.addr_mask
-
-            # Move to the next cycle or into the read/write phase.
-            cycle = int(self.state[-1])
-            if cycle == 3:
-                self.log(f'Address set to 0x{self.addr:04x}')
-                self.state = 'dummy0' if self.mode == READ else 'write0'
-            else:
-                self.state = f'addr{cycle + 1}'
-        elif self.state.startswith('dummy'):
-            # There are two dummy cycles before read data becomes available.
-            self.state = 'dummy1' if self.state[-1] == '0' else 'read0'
-        elif self.state == 'write0':
-            # On the first write cycle the top 4b of the byte are received and
-            # stored into the memory.
-            value = self.data[self.addr] or 0
-            value = ((sio & 0xf) << 4) | (value & 0xf)
-
-            self.data[self.addr] = value
-            self.state = 'write1'
-        elif self.state == 'write1':
-            # On the second write cycle the low 4b of the byte are received and
-            # the address is incremented for the next byte of data.
-            value = (self.data[self.addr] & 0xf0) | (sio & 0xf)
-
-            self.log(f'Write 0x{self.addr:04x}: 0x{value:02x}')
-            self.data[self.addr] = value
-            write[self.addr] = value
-            self.addr = (self.addr + 1) & self.addr_mask
-
-            # In sequential mode we continually receive bytes so go back to the
-            # previous state.
-            self.state = 'write0'
-        elif self.state.startswith('read'):
-            # The actual data for a read is only presented on the falling edge
-            # of the clock so all that needs to be done on the rising edge is
-            # the toggling between the two states.
-            self.state = 'read1' if self.state[-1] == '0' else 'read0'
-        else:
-            raise Exception(f'Unknown state: {self.state}')
-
-        return write
+        # SIO is left for the handlers to convert as it isn't driven during
+        # reads and may not be a valid integer.
+        self.rising[self.state](sio)
 
     # Called on the falling edge of the clock, returning the 4b data that was
     # read from the memory.
     def falling_edge(self):
         # If we're not in a read state then there's nothing to return.
-        if not self.state or not self.state.startswith('read'):
+        if self.state != DATA_READ:
             return None
 
-        # Get the byte from the memory and complain if we're attempting to read
-        # an uninitialised value.
-        value = self.data[self.addr]
-        if value is None:
-            raise Exception(f'Uninitialised read at 0x{self.addr:04x}')
+        addr = self.addr
+        if not self.vld[addr]:
+            raise Exception(f'Uninitialised read at 0x{addr:04x}')
+
+        # High nibble is presented first, then the low nibble after which the
+        # address moves on to the next sequential byte.
+        if not self.cycle:
+            return self.data[addr] >> 4
+
+        self.addr = (addr + 1) & self.addr_mask
+        self.length += 1
+
+        return self.data[addr] & 0xf
+
+    # First cycle out of reset receives the top 4b of the mode.
+    def _rise_idle(self, sio):
+        self.mode = int(sio) & 0xf
+        self.state = MODE
+
+    # Now we receive the low 4b of the mode.
+    def _rise_mode(self, sio):
+        self.mode = (self.mode << 4) | (int(sio) & 0xf)
+
+        if self.mode not in MODE_NAMES:
+            raise Exception(f'Unknown mode: {self.mode}')
+
+        self.addr = 0
+        self.cycle = 0
+        self.state = ADDR
+
+    # A 16b address is sent in 4b chunks over four cycles in big-endian.
+    def _rise_addr(self, sio):
+        self.addr = ((self.addr << 4) | (int(sio) & 0xf)) & self.addr_mask
+        self.cycle += 1
+
+        if self.cycle < ADDR_CYCLES:
+            return
+
+        self.start = self.addr
+        self.length = 0
+        self.reported = 0
+        self.cycle = 0
+        self.state = DUMMY if self.mode == READ else DATA_WRITE
+
+    # There are two dummy cycles before read data becomes available.
+    def _rise_dummy(self, sio):
+        self.cycle += 1
+
+        if self.cycle == DUMMY_CYCLES:
+            self.cycle = 0
+            self.state = DATA_READ
+
+    # Top 4b of each byte is received first, then the low 4b after which the
+    # address moves on to the next sequential byte.
+    def _rise_write(self, sio):
+        addr = self.addr
+        sio = int(sio) & 0xf
+
+        if not self.cycle:
+            self.data[addr] = (sio << 4) | (self.data[addr] & 0xf)
+            self.vld[addr] = 1
+            self.cycle = 1
+            return
+
+        self.data[addr] = (self.data[addr] & 0xf0) | sio
+        self.addr = (addr + 1) & self.addr_mask
+        self.length += 1
+        self.cycle = 0
+
+    # The actual data for a read is only presented on the falling edge of the
+    # clock so all that needs to be done on the rising edge is the toggling
+    # between the two nibbles.
+    def _rise_read(self, sio):
+        self.cycle ^= 1
+
+    # End the current transaction, reporting anything that hasn't already been
+    # reported.
+    def _end(self):
+        if self.state in (DATA_WRITE, DATA_READ):
+            if self.log:
+                self.log(f'{MODE_NAMES[self.mode]} 0x{self.start:04x} '
+                         f'length={self.length}')
+
+            if self.state == DATA_WRITE:
+                self.flush()
+            elif self.cb and self.length:
+                self.cb(READ, self.start, self.length)
+
+        self.state = IDLE
+        self.mode = None
+
+
+# Load an image of big-endian 16b words into the pair of memories via the
+# backdoor, splitting each word in a single pass. The LO memory takes the low
+# nibble of each byte and HI the high nibble.
+def backdoor_load_image(lo, hi, image, addr=0):
+    if len(image) % 2:
+        raise Exception('Image must contain whole 16b words')
+
+    lo_data = bytearray(len(image) // 2)
+    hi_data = bytearray(len(image) // 2)
 
-        # Mask off and return the appropriate nibble based on the state.
-        if self.state[-1] == '0':
-            self.log(f'Read 0x{self.addr:04x}: 0x{value:02x}')
-            value = (value >> 4) & 0xf
-        else:
-            value &= 0xf
+    for i, (top, bot) in enumerate(zip(image[0::2], image[1::2])):
+        lo_data[i] = ((top & 0x0f) << 4) | (bot & 0x0f)
+        hi_data[i] = (top & 0xf0) | (bot >> 4)
 
-            # On second read cycle increment address for next sequential byte.
-            self.addr = (self.addr + 1) & self.addr_mask
+    lo.backdoor_load_bytes(addr, lo_data)
+    hi.backdoor_load_bytes(addr, hi_data)
 
-        return value
+    for mem in (lo, hi):
+        if mem.log:
+            mem.log(f'Backdoor loaded {len(image) // 2} bytes at 0x{addr:04x}')
@@ -0,0 +1,143 @@
+import collections
+import mmap
+import pathlib
+import struct
+import yaml
+
+
+# Stimulus and expected response for a test, shared by the behavioural model,
+# the cocotb bench, and podi.
+#
+# UART data is given in a test's YAML either inline as the input and output
+# lists, or as input_file and output_file naming binary files of big-endian
+# 16b words relative to the YAML. Files are memory mapped and read through a
+# cursor so data heavy tests are never parsed or held as python lists. Input
+# pin events are few so stay inline in input_pin.
+
+
+# Big-endian 16b words of a memory mapped file.
+class Mapped:
+    def __init__(self, path):
+        with open(path, 'rb') as f:
+            size = f.seek(0, 2)
+            if size % 2:
+                raise Exception(f'Odd number of bytes in {path}')
+
+            # Empty files can't be mapped.
+            self.map = None
+            if size:
+                self.map = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+
+        self.size = size // 2
+
+    def __len__(self):
+        return self.size
+
+    def __getitem__(self, idx):
+        if not 0 <= idx < self.size:
+            raise IndexError(idx)
+
+        return struct.unpack_from('>H', self.map, idx * 2)[0]
+
+
+# Cursor over a sequence of 16b words consumed from the front. Copies share the
+# underlying words, and each has its own position into them.
+class Words:
+    def __init__(self, items=(), pos=0):
+        self.items = items
+        self.pos = pos
+
+    # Open a binary file of big-endian 16b words.
+    @classmethod
+    def open(cls, path):
+        return cls(Mapped(path))
+
+    def copy(self):
+        return Words(self.items, self.pos)
+
+    # Move the cursor to a number of words from the start.
+    def seek(self, pos):
+        if not 0 <= pos <= len(self.items):
+            raise Exception(f'Seek to {pos} outside {len(self.items)} words')
+
+        self.pos = pos
+
+    def popleft(self):
+        if self.pos >= len(self.items):
+            raise IndexError('No words left')
+
+        self.pos += 1
+        return self.items[self.pos - 1]
+
+    # Words left, indexed from the cursor.
+    def __getitem__(self, idx):
+        if not 0 <= idx < len(self):
+            raise IndexError(idx)
+
+        return self.items[self.pos + idx]
+
+    def __len__(self):
+        return len(self.items) - self.pos
+
+    def __bool__(self):
+        return len(self) > 0
+
+    def __iter__(self):
+        for idx in range(self.pos, len(self.items)):
+            yield self.items[idx]
+
+
+# Load the YAML config for a test with any stimulus files resolved relative to
+# it, giving an empty config if the file is empty.
+def load(path):
+    path = pathlib.Path(path)
+
+    with open(path, 'r') as f:
+        config = yaml.safe_load(f) or {}
+
+    for key in ('input_file', 'output_file'):
+        if key in config:
+            config[key] = path.parent / config[key]
+
+    return config
+
+
+# Words from the inline list or file for a key, as unsigned 16b values.
+def _words(config, key):
+    if f'{key}_file' in config:
+        if key in config:
+            raise Exception(f'Both {key} and {key}_file given')
+
+        return Words.open(config[f'{key}_file'])
+
+    return Words([x & 0xffff for x in config.get(key, [])])
+
+
+# Cursor over the words to send into the UART.
+def uart_input(config):
+    return _words(config, 'input')
+
+
+# Cursor over the words expected from the UART, before the end of test.
+def uart_output(config):
+    return _words(config, 'output')
+
+
+# Queue of input pin events, each a mapping of time and pins.
+def pin_events(config):
+    return collections.deque(config.get('input_pin', []))
+
+
+# Compare words received over the UART with those expected, returning a
+# description of the first difference or None if they match.
+def compare(ref, data):
+    for idx, (x, y) in enumerate(zip(ref, data)):
+        if x != y:
+            return (
+                f'word {idx} expected 0x{x:04x} but received 0x{y:04x}'
+            )
+
+    if len(ref) != len(data):
+        return f'expected {len(ref)} words but received {len(data)}'
+
+    return None
@@ -1,7 +1,8 @@
 import cocotb
-import struct
+import collections
 
 from cocotb.clock import Clock
+from cocotb.utils import get_sim_time
 from cocotb.triggers import (
     RisingEdge,
     FallingEdge,
@@ -14,6 +15,7 @@ import isa
 import objdump
 import sim
 import sqi
+import stim
 import uart
 
 
@@ -24,25 +26,12 @@ class Callback(sim.Callback):
 
         self.tb = tb
         self.log = tb.log
-        self.mem = {}
 
         # Load a local copy of the memory for the simulator.
-        with open(path, 'rb') as f:
-            data = f.read()
-
-        for i in range(len(data) // 2):
-            self.mem[i] = data[i*2:i*2+2]
+        self.mem = sim.Memory(path)
 
     def fetch(self, pc):
-        # Fetch 16b or 32b to cover a following immediate.
-        data = self.mem.get(pc)
-        assert data is not None, f'{pc:04x}'
-        data += self.mem.get((pc + 1) & 0xffff, b'')
-
-        instr = objdump.decode(data, max_items=1)[0]
-        self.log(f'SIM_RUN: pc={pc:#06x} instr={instr}')
-
-        return instr
+        return objdump.decode(self.mem.fetch(pc), max_items=1)[0]
 
     # Update register write scoreboard.
     def write_reg(self, reg, value):
@@ -58,10 +47,11 @@ class Callback(sim.Callback):
     def write_uart(self, value):
         self.log(f'SIM_UTX: value={value:#06x}')
         self.tb.sim_utx.append(value)
+        self.tb.sim_utx_sent += 1
 
     # Read the next value from the UART.
     def read_uart(self):
-        value = self.tb.sim_urx.pop(0)
+        value = self.tb.sim_urx.popleft()
         self.log(f'SIM_URX: value={value:#06x}')
         return value
 
@@ -69,11 +59,11 @@ class Callback(sim.Callback):
     def write_mem(self, addr, value):
         self.log(f'SIM_MEM_WR: addr={addr:#06x} value={value:#06x}')
         self.tb.sim_st_data[addr] = value
-        self.mem[addr] = struct.pack('>H', value)
+        self.mem.write(addr, value)
 
     # Load value from memory.
     def read_mem(self, addr):
-        value, = struct.unpack('>H', self.mem[addr])
+        value = self.mem.read(addr)
         self.log(f'SIM_MEM_RD: addr={addr:#06x} value={value:#06x}')
         return value
 
@@ -91,19 +81,27 @@ class Callback(sim.Callback):
 
 # Bench used with cocotb to run tests on the RTL.
 class TestBench:
-    def __init__(self, dut, path, config, timeout, fpga):
+    def __init__(self, dut, path, config, timeout, fpga, cycles=None):
         self.dut = dut
         self.config = config
         self.timeout = timeout
+        self.cycles = cycles
         self.log = dut._log.info
         self.fpga = fpga
 
+        # Store data written to the RTL's memories for checking.
+        self.rtl_st_data_lo = {}
+        self.rtl_st_data_hi = {}
+
         # Create the two memories, one for low nibbles and one for high.
         # Not required in FPGA mode as memories are driven by the verilog.
         if not self.fpga:
             self.mem_lo = sqi.Memory(log=lambda x: self.log(f'SQI_LO: {x}'))
             self.mem_hi = sqi.Memory(log=lambda x: self.log(f'SQI_HI: {x}'))
 
+            self.mem_lo.cb = self._mem_writes(self.mem_lo, self.rtl_st_data_lo)
+            self.mem_hi.cb = self._mem_writes(self.mem_hi, self.rtl_st_data_hi)
+
         # Create behavioural model for comparison with the RTL.
         self.cb = Callback(self, path)
         self.sim = sim.Sim(self.cb)
@@ -114,22 +112,23 @@ class TestBench:
         # Whether predicate register was written by sim and its value.
         self.sim_pred = None
 
-        # Received UART from sim and RTL.
-        self.sim_utx = []
-        self.rtl_utx = []
+        # Received UART from sim and RTL, and the number of values sent by the
+        # sim in total.
+        self.sim_utx = collections.deque()
+        self.rtl_utx = collections.deque()
+        self.sim_utx_sent = 0
 
-        # Expected values from the UART with the end of test appended.
-        self.ref_utx = [x & 0xffff for x in self.config.get('output', [])]
-        self.ref_utx += [ord(x) for x in '@@END@@']
+        # Expected values from the UART, followed by the end of test.
+        self.ref_utx = stim.uart_output(self.config)
+        self.ref_end = collections.deque(ord(x) for x in '@@END@@')
 
-        # Values to be sent into the UART.
-        self.sim_urx = list(self.config.get('input', []))
-        self.rtl_urx = list(self.sim_urx)
+        # Values to be sent into the UART, with separate cursors for the model
+        # and RTL as each consumes them at its own pace.
+        self.sim_urx = stim.uart_input(self.config)
+        self.rtl_urx = self.sim_urx.copy()
 
         # Store data to check for an instruction.
         self.sim_st_data = {}
-        self.rtl_st_data_lo = {}
-        self.rtl_st_data_hi = {}
 
         # Exit code from the test.
         self.exit_code = None
@@ -145,15 +144,19 @@ class TestBench:
 
         # Input pins and sequence to write.
         self.in_pins = 0
-        self.in_pins_next = self.config.get('input_pin', [])
+        self.in_pins_next = stim.pin_events(self.config)
 
         # Signal set when we've seen the test end condition.
         self.end_of_test = Event()
 
+        # Checks the behavioural model for the test no longer making progress.
+        self.hang = sim.HangCheck()
+
         self.log('BENCH: INIT BEGIN')
 
         if not self.fpga:
-            self._load_binary(path)
+            image = self.cb.mem.image()
+            sqi.backdoor_load_image(self.mem_lo, self.mem_hi, image)
 
         self.log('BENCH: INIT COMPLETE')
 
@@ -161,20 +164,17 @@ class TestBench:
     def tb(self):
         return self.dut.tb_u if self.fpga else self.dut
 
-    # Load the input binary from file into the two memories.
-    def _load_binary(self, path):
-        with open(path, 'rb') as f:
-            addr = 0
-            while data := f.read(2):
-                data, = struct.unpack('>H', data)
+    # Transaction callback for a memory, recording the bytes written.
+    def _mem_writes(self, mem, st_data):
+        def cb(mode, addr, length):
+            if mode != sqi.WRITE:
+                return
 
-                lo = ((data & 0x0f) >> 0) | ((data & 0x0f00) >> 4)
-                hi = ((data & 0xf0) >> 4) | ((data & 0xf000) >> 8)
+            for i in range(length):
+                x = (addr + i) & mem.addr_mask
+                st_data[x] = mem.data[x]
 
-                self.mem_lo.backdoor_load(addr, lo)
-                self.mem_hi.backdoor_load(addr, hi)
-
-                addr += 1
+        return cb
 
     # Run the simulation and checkers.
     async def run(self):
@@ -198,11 +198,21 @@ class TestBench:
         self.dut.i_tb_rst_n.value = 1
 
         self.log('BENCH: RESET COMPLETE')
+        start = get_sim_time('ns')
 
         # Wait for test to end.
         await with_timeout(self.end_of_test.wait(), self.timeout, 'ns')
         self.log(f'BENCH: TEST COMPLETE exit_code={self.exit_code:#06x}')
 
+        # Record the number of GCK cycles taken for comparing against the
+        # behavioural model's timing estimate.
+        cycles = int(get_sim_time('ns') - start) // 2
+        self.log(f'BENCH: CYCLES {cycles}')
+
+        if self.cycles:
+            with open(self.cycles, 'w') as f:
+                f.write(f'{cycles}\n')
+
         # Perform final end-of-test checks.
         self._check_uart_data(final=True)
 
@@ -217,30 +227,31 @@ class TestBench:
             cs = self.dut.o_tb_mem_lo_cs
             sio_in = self.dut.i_tb_mem_lo_sio
             sio_out = self.dut.o_tb_mem_lo_sio
-            st_data = self.rtl_st_data_lo
         else:
             sck = self.dut.o_tb_mem_hi_sck
             cs = self.dut.o_tb_mem_hi_cs
             sio_in = self.dut.i_tb_mem_hi_sio
             sio_out = self.dut.o_tb_mem_hi_sio
-            st_data = self.rtl_st_data_hi
 
         # Wait for chip to come out of reset.
         await RisingEdge(self.dut.i_tb_rst_n)
 
         while True:
             await RisingEdge(sck)
-            if writes := mem.rising_edge(cs.value, sio_out.value):
-                st_data.update(writes)
+            mem.rising_edge(cs.value, sio_out.value)
 
             await FallingEdge(sck)
             if (data := mem.falling_edge()) is not None:
                 sio_in.value = data
 
     # Check instructions perform perform the same operations as the behavioural
-    # model implementation.
+    # model implementation. The bench only wakes when an instruction completes
+    # and samples on the following falling edge of GCK, once everything has
+    # settled. Anything written then is seen by the RTL on the next rising edge
+    # as if it had been written on the edge the instruction completed.
     async def _check_instr(self):
         done = self.tb().instr_done_q
+        gck = self.dut.i_tb_gck
         time = 0
 
         # Reset pins to zero.
@@ -251,9 +262,11 @@ class TestBench:
         await RisingEdge(self.dut.i_tb_rst_n)
 
         while True:
-            await RisingEdge(self.dut.i_tb_gck)
+            # Wait for an instruction to complete in the RTL. Completion is a
+            # single cycle pulse so every instruction has a rising edge.
+            await RisingEdge(done)
+            await FallingEdge(gck)
 
-            # Wait for an instruction to complete in the RTL.
             if not done.value:
                 continue
 
@@ -262,7 +275,9 @@ class TestBench:
 
             # Run instruction on the behavioural model and check the RTL did the
             # same thing.
-            self.sim.tick()
+            pc = self.sim.pc
+            instr = self.sim.tick()
+            self.log(f'SIM_RUN: pc={pc:#06x} instr={instr}')
             self._check_reg_writes()
             self._check_pred_writes()
             self._check_pin_writes()
@@ -270,9 +285,25 @@ class TestBench:
             if not self.fpga:
                 self._check_mem_writes()
 
+            # Pair up any UART data the RTL sent before the model got to it.
+            self._check_uart_data()
+
+            # Fail straight away if the model has stopped making progress, as
+            # the RTL is running the same instructions. Only possible once
+            # there are no more pin events to come.
+            if self.in_pins_next:
+                self.hang.reset(self.sim.ticks)
+            else:
+                self.hang.step(
+                    self.sim.ticks,
+                    self.sim.pc,
+                    self._hang_state,
+                    lambda: bytes(self.cb.mem.words),
+                )
+
             # Update input pins.
             while self.in_pins_next and time >= self.in_pins_next[0]['time']:
-                info = self.in_pins_next.pop(0)['pins']
+                info = self.in_pins_next.popleft()['pins']
                 for k, v in info.items():
                     self.in_pins &= ~(1 << k)
                     self.in_pins |= v << k
@@ -281,6 +312,15 @@ class TestBench:
             # Increment time counter once per instruction run.
             time += 1
 
+    # State of the model and bench for the hang check.
+    def _hang_state(self):
+        return (
+            sim.hang_state(self.sim),
+            self.sim_utx_sent,
+            len(self.sim_urx),
+            self.in_pins,
+        )
+
     # Check outstanding register writes match.
     def _check_reg_writes(self):
         rtl_sb = self.tb().reg_sb
@@ -335,8 +375,8 @@ class TestBench:
     # Check data received from the UART.
     def _check_uart_data(self, final=False):
         while self.sim_utx and self.rtl_utx:
-            sim = self.sim_utx.pop(0)
-            rtl = self.rtl_utx.pop(0)
+            sim = self.sim_utx.popleft()
+            rtl = self.rtl_utx.popleft()
 
             self.log(f'UART: sim={sim:#06x} rtl={rtl:#06x}')
             assert sim == rtl, 'utx data'
@@ -344,8 +384,11 @@ class TestBench:
             # If we have more reference data then process it, otherwise we're
             # receiving the exit code.
             if self.ref_utx:
-                ref = self.ref_utx.pop(0)
+                ref = self.ref_utx.popleft()
                 assert ref == rtl, 'utx ref'
+            elif self.ref_end:
+                ref = self.ref_end.popleft()
+                assert ref == rtl, 'utx end of test'
             else:
                 self.exit_code = rtl
                 self.end_of_test.set()
@@ -360,23 +403,39 @@ class TestBench:
         assert not self.sim_urx, 'outstanding sim urx'
         assert not self.rtl_urx, 'outstanding rtl urx'
 
-    # Continuously check UART data.
+    # Receive UART data from the RTL and check it. The line is idle between
+    # each 8b frame so the bench sleeps until the falling edge of a start bit,
+    # then samples one bit per cycle on the falling edge of GCK.
     async def _check_uart(self):
         tx = self.dut.o_tb_uart_tx
+        gck = self.dut.i_tb_gck
 
         # Wait for reset.
         await RisingEdge(self.dut.i_tb_rst_n)
 
         while True:
-            await RisingEdge(self.dut.i_tb_gck)
+            await FallingEdge(tx)
+            await FallingEdge(gck)
+
+            # Ignore glitches that didn't last until the sample point.
+            if tx.value:
+                continue
 
             self.urx.rising_edge(tx.value)
+            for _ in range(8):
+                await FallingEdge(gck)
+                self.urx.rising_edge(tx.value)
+
             self._check_uart_data()
 
     # Send new data into the chip via UART as requested by the ready signal.
+    # Bits are driven on the falling edge of GCK, so the RTL sees them on the
+    # same rising edge as if driven on the previous one. Once the line is idle
+    # the bench sleeps until ready is raised.
     async def _send_uart(self):
         ready = self.dut.o_tb_uart_rx_rdy
         data = self.dut.i_tb_uart_rx
+        gck = self.dut.i_tb_gck
 
         # Make sure data starts as IDLE before reset.
         data.setimmediatevalue(1)
@@ -385,11 +444,25 @@ class TestBench:
         await RisingEdge(self.dut.i_tb_rst_n)
 
         while True:
-            await RisingEdge(self.dut.i_tb_gck)
+            await FallingEdge(gck)
+
+            idle = self.utx.state == 'idle_lo'
+
+            # EX stalled on URX with nothing left to send can never progress.
+            assert not (idle and ready.value and not self.rtl_urx), \
+                f'URX stalled with no input left at pc={self.sim.pc:#06x}'
+
             data.value = self.utx.rising_edge(ready.value)
 
+            if idle and self.utx.state == 'idle_lo':
+                await RisingEdge(ready)
+
     # Check store data is correct.
     def _check_mem_writes(self):
+        # Pick up writes from transactions that are still in progress.
+        self.mem_lo.flush()
+        self.mem_hi.flush()
+
         # Merge the writes to high and low memory into single values.
         addrs = set(self.rtl_st_data_lo.keys())
         addrs |= set(self.rtl_st_data_hi.keys())
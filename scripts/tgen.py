@@ -252,10 +252,8 @@ def rand_instr(args, state):
     pc = state.sim_.pc
 
     # Generate random operand values.
-    op_names = set(k for k in isa.ENCODINGS[mnem] if k not in '01?')
-    op_names = sorted(op_names, key=lambda x: isa.OPERAND_ORDER.index(x))
     ops = {}
-    for op in op_names:
+    for op, *_ in isa.OPERAND_FIELDS[mnem]:
         if op in 'abcrs':
             ops[op] = rand_imm(0, 15)
 
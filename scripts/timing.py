@@ -0,0 +1,87 @@
+import argparse
+import pathlib
+
+import sim
+import stim
+
+
+# Run the behavioural model with timing enabled on each test that has a cycle
+# count recorded by an RTL run, returning (test, rtl, sim) for each.
+def compare(root, build, timeout):
+    results = []
+
+    for path in sorted(root.rglob('*.out')):
+        cycles = path.with_name(path.name + '.cycles')
+        if not cycles.is_file():
+            continue
+
+        with open(cycles, 'r') as f:
+            rtl = int(f.read())
+
+        config = stim.load(path.relative_to(build).with_suffix('.yaml'))
+
+        model = sim.run_test(path, config, timeout, timing=True)
+        results.append((path.relative_to(build), rtl, model.timing.cycles))
+
+    return results
+
+
+# Print a table of the cycle counts and the error of each estimate, followed by
+# a summary across all tests. Having no RTL results isn't an error as runs may
+# only have used the behavioural model.
+def report(results):
+    if not results:
+        print('No RTL cycle counts found, run tests on RTL to compare')
+        return
+
+    width = max(len(str(x[0])) for x in results)
+    print(f'{"TEST":{width}}  {"RTL":>10}  {"SIM":>10}  {"ERROR":>8}')
+
+    errors = []
+    for test, rtl, model in results:
+        error = (model - rtl) / rtl * 100
+        errors.append(abs(error))
+        print(f'{str(test):{width}}  {rtl:10d}  {model:10d}  {error:+7.1f}%')
+
+    mean = sum(errors) / len(errors)
+    print(f'\nMean absolute error {mean:.1f}%, worst {max(errors):.1f}%')
+
+
+# Parse input arguments.
+def parse_args():
+    parser = argparse.ArgumentParser()
+
+    parser.add_argument(
+        'input',
+        metavar='INPUT',
+        type=pathlib.Path,
+        help='Directory to search for built tests.',
+    )
+
+    parser.add_argument(
+        '-b',
+        '--build',
+        default='build',
+        type=pathlib.Path,
+        help='Build directory, used to find the YAML config for each test.',
+    )
+
+    parser.add_argument(
+        '-t',
+        '--timeout',
+        default=500000,
+        type=int,
+        help='Number of ticks to run before timing out.',
+    )
+
+    args = parser.parse_args()
+
+    if not args.input.is_dir():
+        raise Exception(f'Bad input directory: {args.input}')
+
+    return args
+
+
+if __name__ == '__main__':
+    args = parse_args()
+    report(compare(args.input, args.build, args.timeout))
@@ -47,10 +47,11 @@ class URX:
 # Send UART data to the RTL.
 class UTX:
     def __init__(self, data):
-        # Queue of data to send in 16b chunks.
+        # Queue of data to send in 16b chunks, consumed from the front.
         self.data = data
 
-        # Number of bits sent out of the current 16b chunk.
+        # Current 16b chunk and the number of bits sent out of it.
+        self.word = 0
         self.bits = 0
 
         # Start in idle state.
@@ -71,22 +72,22 @@ class UTX:
                 assert self.data, 'No more data to send!'
                 out = 0
                 self.state = 'data'
+                self.word = self.data.popleft()
                 self.bits = 0
             else:
                 out = 1
         elif self.state == 'data':
             # Extract the low bit and increment the counter.
-            out = self.data[0] & 1
-            self.data[0] >>= 1
+            out = self.word & 1
+            self.word >>= 1
             self.bits += 1
 
             # If we've now sent 8b we need to transition to the next 8b
-            # transaction through idle. If we've done all 16b then we can pop
-            # the buffer and return to reset.
+            # transaction through idle. If we've done all 16b then we can
+            # return to reset.
             if self.bits == 8:
                 self.state = 'idle_hi'
             elif self.bits == 16:
-                self.data.pop(0)
                 self.state = 'idle_lo'
         elif self.state == 'idle_hi':
             # Pull high to reset.
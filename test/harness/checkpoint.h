@@ -0,0 +1,205 @@
+#ifndef IDLI_HARNESS_CHECKPOINT_H
+#define IDLI_HARNESS_CHECKPOINT_H
+
+#include <cstdint>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "config.h"
+#include "isim.h"
+
+
+// Architectural state written by "sim.py --checkpoint" for warm starting the
+// bench part way through a test, in the format of sim.Snapshot. Fields follow
+// the behavioural model, with -1 marking registers and out pins that haven't
+// been written. State only used by the python model is skipped.
+struct Checkpoint
+{
+    uint64_t      ticks = 0;
+    uint16_t      pc = 0;
+    int           regs[16] = {};
+    bool          pred = false;
+    uint8_t       cond = 0;
+    isim_count_t  count_op = ISIM_COUNT_NONE;
+    int           num_count = 0;
+    int           max_count = 0;
+    bool          cin = false;
+    int           out_pins[4] = {};
+
+    // Number of UART values already sent and received by the test.
+    size_t        uart_tx = 0;
+    size_t        uart_rx = 0;
+
+    // Memory image expanded to the full 64K words, and the ranges of it that
+    // have been initialised as (start, length) in 16b words.
+    std::vector<uint16_t>                         image;
+    std::vector<std::pair<uint32_t, uint32_t>>    mem;
+};
+
+
+// Parse a flow list of integers into a fixed size array.
+static inline void checkpoint_list(const std::string &value, int *out,
+                                   size_t size)
+{
+    const std::vector<std::string> items = config_flow(value, '[', ']');
+    if (items.size() != size)
+    {
+        throw std::runtime_error("Bad list length in checkpoint: " + value);
+    }
+
+    for (size_t i = 0; i < size; ++i)
+    {
+        out[i] = config_int(items[i]);
+    }
+}
+
+// Load a checkpoint and the memory image written alongside it.
+static inline Checkpoint checkpoint_load(const std::string &path)
+{
+    std::ifstream f(path);
+    if (!f)
+    {
+        throw std::runtime_error("Failed to open checkpoint: " + path);
+    }
+
+    Checkpoint ckpt;
+
+    std::string line;
+    while (std::getline(f, line))
+    {
+        const std::string text = config_strip(line.substr(0, line.find('#')));
+        if (text.empty())
+        {
+            continue;
+        }
+
+        std::string key, value;
+        if (!config_key(text, key, value))
+        {
+            throw std::runtime_error("Bad line in checkpoint: " + text);
+        }
+
+        if (key == "ticks")
+        {
+            ckpt.ticks = config_int(value);
+        }
+        else if (key == "pc")
+        {
+            ckpt.pc = config_int(value);
+        }
+        else if (key == "regs")
+        {
+            checkpoint_list(value, ckpt.regs, 16);
+        }
+        else if (key == "pred")
+        {
+            ckpt.pred = config_int(value);
+        }
+        else if (key == "cond")
+        {
+            ckpt.cond = config_int(value);
+        }
+        else if (key == "count_op")
+        {
+            if (value == "null")
+            {
+                ckpt.count_op = ISIM_COUNT_NONE;
+            }
+            else if (value == "carry")
+            {
+                ckpt.count_op = ISIM_COUNT_CARRY;
+            }
+            else if (value == "and")
+            {
+                ckpt.count_op = ISIM_COUNT_AND;
+            }
+            else if (value == "or")
+            {
+                ckpt.count_op = ISIM_COUNT_OR;
+            }
+            else
+            {
+                throw std::runtime_error("Bad count_op in checkpoint: "
+                                         + value);
+            }
+        }
+        else if (key == "num_count")
+        {
+            ckpt.num_count = config_int(value);
+        }
+        else if (key == "max_count")
+        {
+            ckpt.max_count = config_int(value);
+        }
+        else if (key == "cin")
+        {
+            ckpt.cin = config_int(value);
+        }
+        else if (key == "out_pins")
+        {
+            checkpoint_list(value, ckpt.out_pins, 4);
+        }
+        else if (key == "uart_tx")
+        {
+            ckpt.uart_tx = config_flow(value, '[', ']').size();
+        }
+        else if (key == "uart_rx_used")
+        {
+            ckpt.uart_rx = config_int(value);
+        }
+        else if (key == "uart_tail" || key == "in_pins")
+        {
+            continue;
+        }
+        else if (key == "mem")
+        {
+            const std::vector<std::string> items = config_flow(value, '[',
+                                                               ']');
+            if (items.size() % 2)
+            {
+                throw std::runtime_error("Bad memory ranges in checkpoint");
+            }
+
+            for (size_t i = 0; i < items.size(); i += 2)
+            {
+                ckpt.mem.emplace_back(config_int(items[i]),
+                                      config_int(items[i + 1]));
+            }
+        }
+        else
+        {
+            throw std::runtime_error("Unknown checkpoint key: " + key);
+        }
+    }
+
+    // Only the initialised ranges are written, one after another.
+    const std::vector<uint16_t> image = config_binary(path + ".bin");
+    ckpt.image.resize(1 << 16);
+
+    size_t pos = 0;
+    for (const auto &range : ckpt.mem)
+    {
+        if (range.first + range.second > ckpt.image.size()
+            || pos + range.second > image.size())
+        {
+            throw std::runtime_error("Checkpoint range outside image");
+        }
+
+        for (uint32_t i = 0; i < range.second; ++i)
+        {
+            ckpt.image[range.first + i] = image[pos++];
+        }
+    }
+
+    if (pos != image.size())
+    {
+        throw std::runtime_error("Checkpoint image doesn't match its ranges");
+    }
+
+    return ckpt;
+}
+
+#endif
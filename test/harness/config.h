@@ -0,0 +1,339 @@
+#ifndef IDLI_HARNESS_CONFIG_H
+#define IDLI_HARNESS_CONFIG_H
+
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+// Input pins to change once the given number of instructions have run.
+struct PinEvent
+{
+    uint64_t                          time = 0;
+    std::vector<std::pair<int, int>>  pins;
+};
+
+// Test configuration from the YAML file alongside each test.
+struct Config
+{
+    std::deque<uint16_t>  input;
+    std::deque<uint16_t>  output;
+    std::deque<PinEvent>  input_pin;
+};
+
+
+// Remove leading and trailing whitespace.
+static inline std::string config_strip(const std::string &s)
+{
+    const size_t begin = s.find_first_not_of(" \t\r");
+    if (begin == std::string::npos)
+    {
+        return "";
+    }
+
+    const size_t end = s.find_last_not_of(" \t\r");
+    return s.substr(begin, end - begin + 1);
+}
+
+// Parse an integer in any of the forms YAML accepts for the tests, including
+// negative and hex values.
+static inline long config_int(const std::string &s)
+{
+    const std::string value = config_strip(s);
+    size_t pos = 0;
+    long result = 0;
+
+    try
+    {
+        result = std::stol(value, &pos, 0);
+    }
+    catch (const std::exception &)
+    {
+        pos = 0;
+    }
+
+    if (value.empty() || pos != value.size())
+    {
+        throw std::runtime_error("Bad integer in config: " + value);
+    }
+
+    return result;
+}
+
+// Split the contents of a flow sequence or mapping, e.g. "[1, 2]".
+static inline std::vector<std::string> config_flow(const std::string &s,
+                                                   char open, char close)
+{
+    const std::string value = config_strip(s);
+    if (value.size() < 2 || value.front() != open || value.back() != close)
+    {
+        throw std::runtime_error("Bad flow collection in config: " + value);
+    }
+
+    std::vector<std::string> items;
+    std::string body = value.substr(1, value.size() - 2);
+
+    size_t pos = 0;
+    while (pos <= body.size())
+    {
+        size_t end = body.find(',', pos);
+        if (end == std::string::npos)
+        {
+            end = body.size();
+        }
+
+        const std::string item = config_strip(body.substr(pos, end - pos));
+        if (!item.empty())
+        {
+            items.push_back(item);
+        }
+
+        pos = end + 1;
+    }
+
+    return items;
+}
+
+// Split "key: value" into its two halves.
+static inline bool config_key(const std::string &s, std::string &key,
+                              std::string &value)
+{
+    const size_t colon = s.find(':');
+    if (colon == std::string::npos)
+    {
+        return false;
+    }
+
+    key = config_strip(s.substr(0, colon));
+    value = config_strip(s.substr(colon + 1));
+    return true;
+}
+
+// Add a "pin: value" entry to a pin event.
+static inline void config_pin(PinEvent &event, const std::string &s)
+{
+    std::string pin, value;
+    if (!config_key(s, pin, value))
+    {
+        throw std::runtime_error("Bad pin in config: " + s);
+    }
+
+    event.pins.emplace_back(config_int(pin), config_int(value));
+}
+
+// Load a binary of big-endian 16b words.
+static inline std::vector<uint16_t> config_binary(const std::string &path)
+{
+    std::ifstream f(path, std::ios::binary);
+    if (!f)
+    {
+        throw std::runtime_error("Failed to open binary: " + path);
+    }
+
+    std::vector<uint16_t> words;
+    unsigned char buf[2];
+
+    while (f.read(reinterpret_cast<char *>(buf), sizeof(buf)))
+    {
+        words.push_back((buf[0] << 8) | buf[1]);
+    }
+
+    if (f.gcount())
+    {
+        throw std::runtime_error("Binary has an odd number of bytes: " + path);
+    }
+
+    return words;
+}
+
+// Path of a file named in a config, relative to the config's directory.
+static inline std::string config_path(const std::string &config,
+                                      const std::string &s)
+{
+    std::string value = config_strip(s);
+    if (value.size() >= 2 && (value.front() == '\'' || value.front() == '"')
+        && value.back() == value.front())
+    {
+        value = value.substr(1, value.size() - 2);
+    }
+
+    const size_t slash = config.rfind('/');
+    if (value.empty() || value.front() == '/' || slash == std::string::npos)
+    {
+        return value;
+    }
+
+    return config.substr(0, slash + 1) + value;
+}
+
+// Load the test configuration. This handles the subset of YAML written by hand
+// and by tgen.py: top-level input/output lists in block or flow style, or
+// input_file/output_file naming binaries of the same, and input_pin as a list
+// of mappings of pins and time. Anything else is an error rather than being
+// silently ignored.
+static inline Config config_load(const std::string &path)
+{
+    std::ifstream f(path);
+    if (!f)
+    {
+        throw std::runtime_error("Failed to open config: " + path);
+    }
+
+    Config config;
+
+    // Current top-level key, and the indent of "pins:" when reading the pins
+    // of the last input_pin entry.
+    std::string top;
+    int pins_indent = -1;
+
+    // Binaries for the UART data, loaded once the lists are known to be empty.
+    std::string input_file, output_file;
+
+    std::string line;
+    while (std::getline(f, line))
+    {
+        line = line.substr(0, line.find('#'));
+
+        const std::string text = config_strip(line);
+        if (text.empty() || text == "---")
+        {
+            continue;
+        }
+
+        const int indent = line.find_first_not_of(' ');
+        std::string key, value;
+
+        // New top-level key, which may have a flow list as its value.
+        if (indent == 0 && text[0] != '-')
+        {
+            if (!config_key(text, top, value))
+            {
+                throw std::runtime_error("Bad line in config: " + text);
+            }
+
+            pins_indent = -1;
+
+            if (top == "input_file" || top == "output_file")
+            {
+                (top == "input_file" ? input_file : output_file)
+                    = config_path(path, value);
+                top.clear();
+                continue;
+            }
+
+            if (top != "input" && top != "output" && top != "input_pin")
+            {
+                throw std::runtime_error("Unknown config key: " + top);
+            }
+
+            if (value.empty())
+            {
+                continue;
+            }
+
+            if (top == "input_pin")
+            {
+                throw std::runtime_error("Flow style input_pin unsupported");
+            }
+
+            for (const std::string &item : config_flow(value, '[', ']'))
+            {
+                auto &list = top == "input" ? config.input : config.output;
+                list.push_back(config_int(item) & 0xffff);
+            }
+
+            continue;
+        }
+
+        if (top.empty())
+        {
+            throw std::runtime_error("Bad line in config: " + text);
+        }
+
+        // Start of a new list entry.
+        std::string entry = text;
+        int entry_indent = indent;
+
+        if (text[0] == '-')
+        {
+            entry = config_strip(text.substr(1));
+            entry_indent = line.find(entry, indent + 1);
+            pins_indent = -1;
+
+            if (top != "input_pin")
+            {
+                auto &list = top == "input" ? config.input : config.output;
+                list.push_back(config_int(entry) & 0xffff);
+                continue;
+            }
+
+            config.input_pin.emplace_back();
+        }
+
+        if (config.input_pin.empty() || top != "input_pin")
+        {
+            throw std::runtime_error("Bad line in config: " + text);
+        }
+
+        PinEvent &event = config.input_pin.back();
+
+        // Lines nested under "pins:" are the pins themselves.
+        if (pins_indent >= 0 && entry_indent > pins_indent)
+        {
+            config_pin(event, entry);
+            continue;
+        }
+
+        pins_indent = -1;
+
+        if (!config_key(entry, key, value))
+        {
+            throw std::runtime_error("Bad line in config: " + text);
+        }
+
+        if (key == "time")
+        {
+            event.time = config_int(value);
+        }
+        else if (key == "pins" && value.empty())
+        {
+            pins_indent = entry_indent;
+        }
+        else if (key == "pins")
+        {
+            for (const std::string &item : config_flow(value, '{', '}'))
+            {
+                config_pin(event, item);
+            }
+        }
+        else
+        {
+            throw std::runtime_error("Unknown input_pin key: " + key);
+        }
+    }
+
+    for (auto [file, list] : {std::make_pair(&input_file, &config.input),
+                              std::make_pair(&output_file, &config.output)})
+    {
+        if (file->empty())
+        {
+            continue;
+        }
+
+        if (!list->empty())
+        {
+            throw std::runtime_error("UART data given inline and in " + *file);
+        }
+
+        const std::vector<uint16_t> words = config_binary(*file);
+        list->assign(words.begin(), words.end());
+    }
+
+    return config;
+}
+
+#endif
@@ -0,0 +1,333 @@
+#ifndef IDLI_HARNESS_LOCKSTEP_H
+#define IDLI_HARNESS_LOCKSTEP_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "checkpoint.h"
+#include "isim.h"
+#include "sqi.h"
+
+
+// State of the RTL when an instruction completes, as reported through DPI by
+// idli_tb_m. Scoreboards are cleared by the RTL after each report.
+struct Retired
+{
+    uint16_t  pc;
+    uint16_t  reg_sb;
+    uint16_t  regs[16];
+    bool      pred_sb;
+    bool      pred;
+    uint8_t   pins_sb;
+    uint8_t   pins;
+};
+
+
+// Native behavioural model run in lockstep with the RTL, performing the same
+// per-instruction checks as tb.py: PC, register, predicate, and output pin
+// writes, and store data. Hooks record what the model did for the next check.
+class Lockstep
+{
+public:
+    Lockstep(const std::string &isa_path, const std::vector<uint16_t> &words,
+             const std::deque<uint16_t> &input)
+        : m_urx(input)
+    {
+        std::ifstream f(isa_path, std::ios::binary);
+        if (!f.read(reinterpret_cast<char *>(&m_isa), sizeof(m_isa))
+            || f.peek() != EOF)
+        {
+            throw std::runtime_error("Bad decode table: " + isa_path);
+        }
+
+        m_sim = isim_new(&m_isa);
+        if (!m_sim)
+        {
+            throw std::runtime_error("Failed to allocate behavioural model");
+        }
+
+        std::vector<uint8_t> image;
+        for (const uint16_t word : words)
+        {
+            image.push_back(word >> 8);
+            image.push_back(word & 0xff);
+        }
+
+        isim_load(m_sim, image.data(), image.size());
+
+        m_sim->hooks.write_reg = write_reg;
+        m_sim->hooks.write_pred = write_pred;
+        m_sim->hooks.write_mem = write_mem;
+        m_sim->hooks.write_uart = write_uart;
+        m_sim->hooks.read_uart = read_uart;
+        m_sim->hooks.write_pin = write_pin;
+        m_sim->hooks.read_pin = read_pin;
+    }
+
+    ~Lockstep()
+    {
+        isim_free(m_sim);
+    }
+
+    Lockstep(const Lockstep &) = delete;
+    Lockstep &operator=(const Lockstep &) = delete;
+
+    // Restore the model's state from a checkpoint, with only the memory in
+    // the checkpoint's initialised ranges marked as valid.
+    void restore(const Checkpoint &ckpt)
+    {
+        m_sim->ticks = ckpt.ticks;
+        m_sim->pc = ckpt.pc;
+        m_sim->regs_vld = 0;
+
+        for (int i = 0; i < 16; ++i)
+        {
+            if (ckpt.regs[i] >= 0)
+            {
+                m_sim->regs[i] = ckpt.regs[i];
+                m_sim->regs_vld |= 1 << i;
+            }
+        }
+
+        m_sim->pred = ckpt.pred;
+        m_sim->cond = ckpt.cond;
+        m_sim->num_count = ckpt.num_count;
+        m_sim->max_count = ckpt.max_count;
+        m_sim->count_op = ckpt.count_op;
+        m_sim->cin = ckpt.cin;
+
+        for (int i = 0; i < 4; ++i)
+        {
+            m_sim->out_pins[i] = ckpt.out_pins[i];
+        }
+
+        std::fill(std::begin(m_sim->mem_vld), std::end(m_sim->mem_vld), 0);
+
+        for (const auto &range : ckpt.mem)
+        {
+            for (uint32_t i = 0; i < range.second; ++i)
+            {
+                const uint32_t addr = range.first + i;
+                m_sim->mem[addr] = ckpt.image[addr];
+                m_sim->mem_vld[addr >> 3] |= 1 << (addr & 7);
+            }
+        }
+    }
+
+    // Input pins seen by the model for the next instruction.
+    void set_pins(uint32_t pins)
+    {
+        m_pins = pins;
+    }
+
+    // Values sent over UART by the model that haven't been checked yet.
+    std::deque<uint16_t> &utx()
+    {
+        return m_utx;
+    }
+
+    // Run the next instruction on the model and check the RTL did the same
+    // thing. RTL store data is passed per memory as it was written.
+    void check(const Retired &rtl, std::map<uint16_t, uint8_t> &st_lo,
+               std::map<uint16_t, uint8_t> &st_hi, const SqiMemory &mem_lo,
+               const SqiMemory &mem_hi)
+    {
+        m_pc = m_sim->pc;
+        expect(rtl.pc, m_pc, "pc");
+
+        s_active = this;
+        const int status = isim_tick(m_sim);
+        s_active = nullptr;
+
+        if (status != ISIM_OK)
+        {
+            fail("behavioural model error", status, m_sim->err);
+        }
+
+        // ZR is skipped as the RTL never sets write enable for it.
+        for (int i = 1; i < 16; ++i)
+        {
+            const bool sim = (m_reg_sb >> i) & 1;
+            const bool wr = (rtl.reg_sb >> i) & 1;
+
+            expect(wr, sim, "reg written", i);
+            if (wr)
+            {
+                expect(rtl.regs[i], m_reg_data[i], "reg data", i);
+            }
+        }
+
+        expect(rtl.pred_sb, m_pred >= 0, "predicate written");
+        if (rtl.pred_sb)
+        {
+            expect(rtl.pred, m_pred, "predicate write data");
+        }
+
+        const int sim_pins = m_pin >= 0 ? 1 << m_pin : 0;
+        expect(rtl.pins_sb, sim_pins, "out pin written");
+        if (rtl.pins_sb)
+        {
+            expect((rtl.pins >> m_pin) & 1, m_pin_value, "out pin value");
+        }
+
+        // Merge the writes to the LO and HI memories into 16b values.
+        std::map<uint16_t, uint16_t> rtl_st;
+        for (const auto *st : {&st_lo, &st_hi})
+        {
+            for (const auto &entry : *st)
+            {
+                const uint16_t addr = entry.first;
+                const int lo = st_lo.count(addr) ? st_lo[addr]
+                                                 : mem_lo.data(addr);
+                const int hi = st_hi.count(addr) ? st_hi[addr]
+                                                 : mem_hi.data(addr);
+
+                rtl_st[addr] = ((lo & 0x0f) << 0) | ((hi & 0x0f) << 4)
+                             | ((lo & 0xf0) << 4) | ((hi & 0xf0) << 8);
+            }
+        }
+
+        // Walk both in address order to report the first that differs.
+        auto rtl_it = rtl_st.begin();
+        auto sim_it = m_st.begin();
+        while (rtl_it != rtl_st.end() || sim_it != m_st.end())
+        {
+            if (sim_it == m_st.end()
+                || (rtl_it != rtl_st.end() && rtl_it->first < sim_it->first))
+            {
+                fail("store written", 1, 0, rtl_it->first);
+            }
+
+            if (rtl_it == rtl_st.end() || sim_it->first < rtl_it->first)
+            {
+                fail("store written", 0, 1, sim_it->first);
+            }
+
+            expect(rtl_it->second, sim_it->second, "store data",
+                   rtl_it->first);
+            ++rtl_it;
+            ++sim_it;
+        }
+
+        // Reset for the next instruction.
+        m_reg_sb = 0;
+        m_pred = -1;
+        m_pin = -1;
+        m_st.clear();
+        st_lo.clear();
+        st_hi.clear();
+    }
+
+    // Whether the model has consumed all of its UART input.
+    bool urx_empty() const
+    {
+        return m_urx.empty();
+    }
+
+private:
+    template <typename T, typename U>
+    void expect(T rtl, U sim, const char *what, int idx=-1)
+    {
+        if (static_cast<long>(rtl) != static_cast<long>(sim))
+        {
+            fail(what, rtl, sim, idx);
+        }
+    }
+
+    [[noreturn]] void fail(const char *what, long rtl, long sim, long idx=-1)
+    {
+        char buf[128];
+        std::snprintf(buf, sizeof(buf),
+                      "%s (%ld) at pc=0x%04x: rtl=0x%lx sim=0x%lx",
+                      what, idx, m_pc, rtl, sim);
+        throw std::runtime_error(buf);
+    }
+
+    // Hooks called by the model. These have no context argument so the model
+    // being ticked is held in s_active.
+    static int write_reg(int reg, int value)
+    {
+        s_active->m_reg_sb |= 1 << reg;
+        s_active->m_reg_data[reg] = value;
+        return ISIM_OK;
+    }
+
+    static int write_pred(int value)
+    {
+        s_active->m_pred = value;
+        return ISIM_OK;
+    }
+
+    static int write_mem(int addr, int value)
+    {
+        s_active->m_st[addr] = value;
+        return ISIM_OK;
+    }
+
+    static int write_uart(int value)
+    {
+        s_active->m_utx.push_back(value);
+        return ISIM_OK;
+    }
+
+    static int read_uart(int *value)
+    {
+        if (s_active->m_urx.empty())
+        {
+            return ISIM_ERR_HOOK;
+        }
+
+        *value = s_active->m_urx.front();
+        s_active->m_urx.pop_front();
+        return ISIM_OK;
+    }
+
+    static int write_pin(int pin, int value)
+    {
+        // Only the first pin written is checked, as in tb.py.
+        if (s_active->m_pin < 0 || s_active->m_pin == pin)
+        {
+            s_active->m_pin = pin;
+            s_active->m_pin_value = value;
+        }
+
+        return ISIM_OK;
+    }
+
+    static int read_pin(int pin, int *value)
+    {
+        *value = (s_active->m_pins >> pin) & 1;
+        return ISIM_OK;
+    }
+
+    static inline Lockstep *s_active = nullptr;
+
+    isim_isa_t  m_isa;
+    isim_t      *m_sim = nullptr;
+
+    // PC of the instruction being checked.
+    uint16_t    m_pc = 0;
+
+    // Pins and UART data seen by the model.
+    uint32_t              m_pins = 0;
+    std::deque<uint16_t>  m_urx;
+    std::deque<uint16_t>  m_utx;
+
+    // Writes performed by the current instruction.
+    uint16_t                      m_reg_sb = 0;
+    uint16_t                      m_reg_data[16] = {};
+    int                           m_pred = -1;
+    int                           m_pin = -1;
+    int                           m_pin_value = 0;
+    std::map<uint16_t, uint16_t>  m_st;
+};
+
+#endif
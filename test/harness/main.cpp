@@ -0,0 +1,1025 @@
+// Standalone verilator bench for idli_tb_m, used for regression runs instead
+// of cocotb. The memories, UART, and input pins are modelled natively and the
+// pass/fail checks match tb.py: UART output must match the test's expected
+// output followed by @@END@@, the value after which is the exit code and must
+// be zero. The native behavioural model from native/ is run in lockstep, with
+// each instruction reported by the RTL through DPI and checked as in tb.py.
+//
+// Arguments are given as plusargs:
+//   +test=PATH     Binary to load into the memories.
+//   +yaml=PATH     Test configuration.
+//   +timeout=NS    Timeout in ns from the end of reset, as with SIM_TIMEOUT.
+//   +cycles=PATH   Optional file to write the GCK cycle count to.
+//   +isa=PATH      Decode table written by native.py, defaulting to isa.bin
+//                  next to the executable.
+//   +lockstep=0    Disable lockstep checking against the behavioural model.
+//   +checkpoint=PATH
+//                  Warm start from a checkpoint written by sim.py, loading its
+//                  state into the RTL before reset is released.
+//   +waves=PATH    Write waves to an FST file when triggered. Failures always
+//                  trigger, and the test is run again to dump the window.
+//   +waves_pc=ADDR Trigger when the instruction at ADDR completes.
+//   +waves_tick=START[:END]
+//                  Trigger once START instructions have completed, stopping
+//                  the capture at END.
+//   +waves_uart=VALUE
+//                  Trigger when the RTL sends VALUE over UART.
+//   +waves_pre=N   GCK cycles captured before the trigger, default 1000.
+//   +waves_post=N  GCK cycles captured after the trigger, default 1000.
+//
+// Many tests can be run against the one build with +batch=PATH, where each
+// line of the file gives the plusargs for a test. These are combined with any
+// others on the command line, and +log=PATH on a line sends that test's output
+// to a file. Tests are run in +jobs=N worker processes, defaulting to one.
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "svdpi.h"
+#include "verilated.h"
+
+#include "Vidli_tb_m.h"
+#include "Vidli_tb_m__Dpi.h"
+#include "Vidli_tb_m___024root.h"
+
+#include "checkpoint.h"
+#include "config.h"
+#include "lockstep.h"
+#include "sqi.h"
+#include "uart.h"
+#include "waves.h"
+
+
+// Period of GCK in ns, matching the clock started by tb.py.
+#define GCK_PERIOD_NS   (2)
+
+// Sequence sent over UART to mark the end of the test.
+static const char END_OF_TEST[] = "@@END@@";
+
+
+// Get the value of a plusarg, or the default if it wasn't given.
+static std::string plusarg(VerilatedContext &ctx, const std::string &name,
+                           const char *def=nullptr)
+{
+    const std::string prefix = name + "=";
+    const std::string match = ctx.commandArgsPlusMatch(prefix.c_str());
+
+    if (match.empty())
+    {
+        if (!def)
+        {
+            throw std::runtime_error("Missing plusarg: +" + prefix);
+        }
+
+        return def;
+    }
+
+    return match.substr(prefix.size() + 1);
+}
+
+
+// One of the two SQI memories along with the previous value of its SCK for
+// detecting edges, and the bytes written since the last instruction check.
+struct MemPort
+{
+    SqiMemory                    mem;
+    bool                         sck = false;
+    std::map<uint16_t, uint8_t>  st;
+
+    explicit MemPort(const char *name) : mem(name) {}
+};
+
+
+class Bench;
+
+// Bench receiving DPI calls from the RTL.
+static Bench *s_bench = nullptr;
+
+
+class Bench
+{
+public:
+    Bench(VerilatedContext &ctx, const Config &config, Waves *waves=nullptr)
+        : m_top(new Vidli_tb_m(&ctx)),
+          m_config(config),
+          m_waves(waves),
+          m_log(!waves || !waves->replaying()),
+          m_utx(m_config.input),
+          m_lo("SQI_LO"),
+          m_hi("SQI_HI")
+    {
+        if (m_waves)
+        {
+            m_waves->attach(*m_top);
+        }
+
+        // Expected output is followed by the end of test marker.
+        for (const char *c = END_OF_TEST; *c; ++c)
+        {
+            m_config.output.push_back(*c);
+        }
+
+        s_bench = this;
+    }
+
+    ~Bench()
+    {
+        s_bench = nullptr;
+        m_top->final();
+    }
+
+    // Split each 16b word across the two memories, with the LO memory taking
+    // the low nibble of each byte and HI the high nibble.
+    void load(const std::vector<uint16_t> &words, uint16_t start=0)
+    {
+        for (size_t i = 0; i < words.size(); ++i)
+        {
+            const uint16_t addr = start + i;
+            const uint16_t data = words[i];
+            const uint8_t lo = (data & 0x0f) | ((data & 0x0f00) >> 4);
+            const uint8_t hi = ((data & 0xf0) >> 4) | ((data & 0xf000) >> 8);
+
+            m_lo.mem.backdoor_load(addr, lo);
+            m_hi.mem.backdoor_load(addr, hi);
+        }
+    }
+
+    // Start from a checkpoint rather than the beginning of the test. Only the
+    // initialised memory is loaded, and UART data and pin events from before
+    // the checkpoint are skipped. Must be called before lockstep().
+    void warm_start(const Checkpoint &ckpt)
+    {
+        for (const auto &range : ckpt.mem)
+        {
+            const auto begin = ckpt.image.begin() + range.first;
+            load(std::vector<uint16_t>(begin, begin + range.second),
+                 range.first);
+        }
+
+        if (ckpt.uart_tx > m_config.output.size()
+            || ckpt.uart_rx > m_config.input.size())
+        {
+            throw std::runtime_error("Checkpoint doesn't match the test");
+        }
+
+        m_config.output.erase(m_config.output.begin(),
+                              m_config.output.begin() + ckpt.uart_tx);
+        m_config.input.erase(m_config.input.begin(),
+                             m_config.input.begin() + ckpt.uart_rx);
+
+        // Instruction N sees the pin events up to N - 1, as in rising_edge().
+        while (!m_config.input_pin.empty()
+               && m_config.input_pin.front().time < ckpt.ticks)
+        {
+            for (const auto &pin : m_config.input_pin.front().pins)
+            {
+                m_pins &= ~(1u << pin.first);
+                m_pins |= pin.second << pin.first;
+            }
+
+            m_config.input_pin.pop_front();
+        }
+
+        m_time = ckpt.ticks;
+        m_ckpt.reset(new Checkpoint(ckpt));
+    }
+
+    // Run the behavioural model in lockstep, loaded with the same program and
+    // UART input as the RTL.
+    void lockstep(const std::string &isa, const std::vector<uint16_t> &words)
+    {
+        m_lockstep.reset(new Lockstep(isa, words, m_config.input));
+
+        if (m_ckpt)
+        {
+            m_lockstep->restore(*m_ckpt);
+        }
+    }
+
+    // Run the test until the exit code is received or the timeout is hit,
+    // returning the number of GCK cycles taken after reset. When dumping
+    // waves the run stops early once the window has been captured.
+    uint64_t run(uint64_t timeout_ns)
+    {
+        m_top->i_tb_gck = 0;
+        m_top->i_tb_rst_n = 1;
+        m_top->i_tb_uart_rx = 1;
+        m_top->i_tb_pins = m_pins;
+        eval();
+
+        // Reset sequence pulls the reset pin low for two cycles.
+        cycle(2);
+        m_top->i_tb_rst_n = 0;
+        eval();
+        cycle(2);
+        m_top->i_tb_rst_n = 1;
+        eval();
+
+        if (m_ckpt)
+        {
+            inject(*m_ckpt);
+            eval();
+        }
+
+        m_lo.sck = m_top->o_tb_mem_lo_sck;
+        m_hi.sck = m_top->o_tb_mem_hi_sck;
+        m_active = true;
+
+        const uint64_t max_cycles = timeout_ns / GCK_PERIOD_NS;
+        uint64_t cycles = 0;
+
+        while (!m_done)
+        {
+            if (cycles++ >= max_cycles)
+            {
+                throw std::runtime_error("Timeout");
+            }
+
+            cycle(1);
+
+            if (m_waves && m_waves->finished())
+            {
+                return cycles;
+            }
+        }
+
+        // Nothing should be left in any of the UART buffers.
+        if (m_lockstep && !m_lockstep->utx().empty())
+        {
+            throw std::runtime_error("outstanding sim utx");
+        }
+
+        if (!m_rtl_utx.empty())
+        {
+            throw std::runtime_error("outstanding rtl utx");
+        }
+
+        if (m_lockstep && !m_lockstep->urx_empty())
+        {
+            throw std::runtime_error("outstanding sim urx");
+        }
+
+        if (!m_config.input.empty())
+        {
+            throw std::runtime_error("outstanding rtl urx");
+        }
+
+        return cycles;
+    }
+
+    uint16_t exit_code() const
+    {
+        return m_exit_code;
+    }
+
+    // Number of GCK cycles run, including reset.
+    uint64_t gck() const
+    {
+        return m_gck;
+    }
+
+    // Called through DPI when an instruction completes in the RTL. Errors
+    // can't be thrown through the verilated model, so are saved and raised
+    // once it returns.
+    void instr_done(const Retired &rtl)
+    {
+        if (m_waves)
+        {
+            m_waves->instr(m_gck, rtl.pc, m_time);
+        }
+
+        if (!m_lockstep || !m_error.empty())
+        {
+            return;
+        }
+
+        try
+        {
+            m_lockstep->check(rtl, m_lo.st, m_hi.st, m_lo.mem, m_hi.mem);
+            uart_check();
+        }
+        catch (const std::exception &e)
+        {
+            m_error = e.what();
+        }
+    }
+
+private:
+    // Evaluate the model, raising any error from a DPI call.
+    void eval()
+    {
+        m_top->eval();
+
+        if (!m_error.empty())
+        {
+            throw std::runtime_error(m_error);
+        }
+    }
+
+    // Load the architectural state from a checkpoint into the RTL. This is
+    // done just after reset is released, when the counter is zero and so the
+    // bottom slice of each rotating register is the one being accessed. The
+    // signals written are made public by public.vlt.
+    void inject(const Checkpoint &ckpt)
+    {
+        auto *root = m_top->rootp;
+
+        // Registers that haven't been written are left at their random
+        // initial value.
+        for (int i = 1; i < 16; ++i)
+        {
+            if (ckpt.regs[i] >= 0)
+            {
+                root->idli_tb_m__DOT__top_u__DOT__ex_u__DOT__rf_u__DOT__regs_q
+                    [i - 1] = ckpt.regs[i];
+            }
+        }
+
+        root->idli_tb_m__DOT__top_u__DOT__ex_u__DOT__pc_u__DOT__pc_q = ckpt.pc;
+        root->idli_tb_m__DOT__top_u__DOT__ex_u__DOT__pred_q = ckpt.pred;
+        root->idli_tb_m__DOT__top_u__DOT__ex_u__DOT__cond_q = ckpt.cond;
+
+        // The RTL counts down the instructions left for the count operation
+        // rather than counting up to the maximum. Carry is only kept between
+        // instructions while CARRY is active so can be restored as is.
+        const bool count = ckpt.count_op != ISIM_COUNT_NONE;
+        const int count_op = count ? ckpt.count_op - ISIM_COUNT_CARRY : 0;
+
+        root->idli_tb_m__DOT__top_u__DOT__ex_u__DOT__count_q
+            = count ? ckpt.max_count - ckpt.num_count : 0;
+        root->idli_tb_m__DOT__top_u__DOT__ex_u__DOT__count_op_q = count_op;
+        root->idli_tb_m__DOT__top_u__DOT__ex_u__DOT__count_first_q
+            = count && ckpt.num_count == 0;
+        root->idli_tb_m__DOT__top_u__DOT__ex_u__DOT__carry_q = ckpt.cin;
+
+        uint8_t pins = 0;
+        for (int i = 0; i < 4; ++i)
+        {
+            pins |= (ckpt.out_pins[i] > 0) << i;
+        }
+
+        root->idli_tb_m__DOT__top_u__DOT__ex_u__DOT__out_pins_q = pins;
+
+        // The first fetch after reset normally sends address zero. Instead
+        // act as if the memories were redirected to the PC, which sends the
+        // address from the buffer a slice per SCK starting from the top.
+        const uint16_t pc = ckpt.pc;
+        const uint16_t addr = ((pc >> 12) & 0xf) | (((pc >> 8) & 0xf) << 4)
+                            | (((pc >> 4) & 0xf) << 8) | ((pc & 0xf) << 12);
+
+        root->idli_tb_m__DOT__top_u__DOT__sqi_u__DOT__redirected_q = 1;
+        root->idli_tb_m__DOT__top_u__DOT__sqi_u__DOT__buf_u__DOT__data_q
+            = addr;
+    }
+
+    // Run GCK for the given number of cycles, driving the models on each
+    // rising edge once reset has finished.
+    void cycle(int n)
+    {
+        for (int i = 0; i < n; ++i)
+        {
+            m_top->i_tb_gck = 1;
+            eval();
+
+            if (m_active)
+            {
+                rising_edge();
+                eval();
+            }
+
+            dump(0);
+
+            m_top->i_tb_gck = 0;
+            eval();
+
+            dump(GCK_PERIOD_NS / 2);
+            m_gck++;
+        }
+    }
+
+    // Dump waves for the current cycle at the given offset into it.
+    void dump(uint64_t offset)
+    {
+        if (m_waves)
+        {
+            m_waves->dump(m_gck, m_gck * GCK_PERIOD_NS + offset);
+        }
+    }
+
+    void rising_edge()
+    {
+        mem_edge(m_lo, m_top->o_tb_mem_lo_sck, m_top->o_tb_mem_lo_cs,
+                 m_top->o_tb_mem_lo_sio, m_top->i_tb_mem_lo_sio);
+        mem_edge(m_hi, m_top->o_tb_mem_hi_sck, m_top->o_tb_mem_hi_cs,
+                 m_top->o_tb_mem_hi_sio, m_top->i_tb_mem_hi_sio);
+
+        // Input pins are updated as instructions complete, counting time in
+        // instructions as tb.py does. Events are taken strictly in order. The
+        // behavioural model runs the instruction on the next edge, so is given
+        // the pins from before the update as it would have seen in tb.py.
+        if (m_top->rootp->idli_tb_m__DOT__instr_done_q)
+        {
+            if (m_lockstep)
+            {
+                m_lockstep->set_pins(m_pins);
+            }
+
+            while (!m_config.input_pin.empty()
+                   && m_time >= m_config.input_pin.front().time)
+            {
+                for (const auto &pin : m_config.input_pin.front().pins)
+                {
+                    m_pins &= ~(1u << pin.first);
+                    m_pins |= pin.second << pin.first;
+                }
+
+                m_config.input_pin.pop_front();
+            }
+
+            m_top->i_tb_pins = m_pins;
+            m_time++;
+        }
+
+        uint16_t value;
+        if (m_urx.rising_edge(m_top->o_tb_uart_tx, value))
+        {
+            if (m_waves)
+            {
+                m_waves->uart(m_gck, value);
+            }
+
+            m_rtl_utx.push_back(value);
+            uart_check();
+        }
+
+        m_top->i_tb_uart_rx = m_utx.rising_edge(m_top->o_tb_uart_rx_rdy);
+    }
+
+    // Clock a memory on the edges of its SCK, recording any writes.
+    void mem_edge(MemPort &port, bool sck, bool cs, uint8_t sio_out,
+                  uint8_t &sio_in)
+    {
+        if (sck == port.sck)
+        {
+            return;
+        }
+
+        port.sck = sck;
+
+        if (sck)
+        {
+            const SqiMemory::Write write = port.mem.rising_edge(cs, sio_out);
+            if (write.vld)
+            {
+                port.st[write.addr] = write.value;
+            }
+
+            return;
+        }
+
+        const int data = port.mem.falling_edge();
+        if (data >= 0)
+        {
+            sio_in = data;
+        }
+    }
+
+    // Check data received from the RTL against the behavioural model and the
+    // expected output, with the value after it being the exit code. Without
+    // lockstep the RTL data is only checked against the expected output.
+    void uart_check()
+    {
+        while (!m_rtl_utx.empty() && !m_done)
+        {
+            const uint16_t rtl = m_rtl_utx.front();
+
+            if (m_lockstep)
+            {
+                std::deque<uint16_t> &sim_utx = m_lockstep->utx();
+                if (sim_utx.empty())
+                {
+                    return;
+                }
+
+                const uint16_t sim = sim_utx.front();
+                sim_utx.pop_front();
+
+                if (sim != rtl)
+                {
+                    fail("utx data", rtl, sim);
+                }
+            }
+
+            m_rtl_utx.pop_front();
+
+            if (m_log)
+            {
+                std::printf("UART: rtl=0x%04x\n", rtl);
+            }
+
+            if (m_config.output.empty())
+            {
+                m_exit_code = rtl;
+                m_done = true;
+                return;
+            }
+
+            const uint16_t ref = m_config.output.front();
+            m_config.output.pop_front();
+
+            if (ref != rtl)
+            {
+                fail("utx ref", rtl, ref);
+            }
+        }
+    }
+
+    [[noreturn]] static void fail(const char *what, uint16_t rtl, uint16_t exp)
+    {
+        char buf[64];
+        std::snprintf(buf, sizeof(buf), "%s: rtl=0x%04x expected=0x%04x",
+                      what, rtl, exp);
+        throw std::runtime_error(buf);
+    }
+
+    std::unique_ptr<Vidli_tb_m> m_top;
+    Config m_config;
+
+    // Triggered wave capture, if enabled. Output is only logged on the first
+    // run and not when running again to dump waves.
+    Waves *m_waves = nullptr;
+    bool m_log = true;
+
+    // Checkpoint being warm started from, if any.
+    std::unique_ptr<Checkpoint> m_ckpt;
+
+    // Behavioural model, if lockstep checking is enabled, and the first error
+    // it reported from a DPI call.
+    std::unique_ptr<Lockstep> m_lockstep;
+    std::string m_error;
+
+    // Bench is receiving TX data hence why URX receives from the RTL's UTX.
+    UartRx m_urx;
+    UartTx m_utx;
+    std::deque<uint16_t> m_rtl_utx;
+
+    MemPort m_lo;
+    MemPort m_hi;
+
+    // Current input pins and the number of instructions completed.
+    uint32_t m_pins = 0;
+    uint64_t m_time = 0;
+
+    // GCK cycles run, including reset.
+    uint64_t m_gck = 0;
+
+    bool m_active = false;
+    bool m_done = false;
+    uint16_t m_exit_code = 0;
+};
+
+
+// Called by idli_tb_m on the edge after an instruction completes, with the
+// same state the cocotb bench checks.
+void idli_tb_instr_done(int pc, int reg_sb, const svBitVecVal *regs,
+                        svBit pred_sb, svBit pred, int pins_sb, int pins)
+{
+    if (!s_bench)
+    {
+        return;
+    }
+
+    Retired rtl;
+    rtl.pc = pc;
+    rtl.reg_sb = reg_sb;
+    rtl.pred_sb = pred_sb;
+    rtl.pred = pred;
+    rtl.pins_sb = pins_sb;
+    rtl.pins = pins;
+
+    // Registers are packed 16b each, two to each 32b word.
+    for (int i = 0; i < 16; ++i)
+    {
+        rtl.regs[i] = regs[i / 2] >> (16 * (i % 2));
+    }
+
+    s_bench->instr_done(rtl);
+}
+
+
+// Arguments needed for each run of the test.
+struct Args
+{
+    std::string  test;
+    std::string  yaml;
+    std::string  isa;
+    std::string  ckpt_path;
+    std::string  cycles_path;
+    uint64_t     timeout_ns = 0;
+    bool         lockstep = true;
+};
+
+
+// Run the test once, raising an error if it fails. Failures are reported to
+// the waves so they trigger a capture, and nothing is logged when running again
+// to dump waves.
+static void run_test(VerilatedContext &ctx, const Args &args, Waves *waves)
+{
+    const bool log = !waves || !waves->replaying();
+    const std::vector<uint16_t> words = config_binary(args.test);
+
+    Bench bench(ctx, config_load(args.yaml), waves);
+
+    // When warm starting the memory image comes from the checkpoint.
+    if (args.ckpt_path.empty())
+    {
+        bench.load(words);
+    }
+    else
+    {
+        const Checkpoint ckpt = checkpoint_load(args.ckpt_path);
+        bench.warm_start(ckpt);
+
+        if (log)
+        {
+            std::printf("BENCH: WARM START %s pc=0x%04x ticks=%" PRIu64 "\n",
+                        args.ckpt_path.c_str(), ckpt.pc, ckpt.ticks);
+        }
+    }
+
+    if (args.lockstep)
+    {
+        bench.lockstep(args.isa, words);
+    }
+
+    try
+    {
+        if (log)
+        {
+            std::printf("BENCH: RUN %s\n", args.test.c_str());
+        }
+
+        const uint64_t cycles = bench.run(args.timeout_ns);
+        const uint16_t exit_code = bench.exit_code();
+
+        if (log)
+        {
+            std::printf("BENCH: TEST COMPLETE exit_code=0x%04x\n", exit_code);
+            std::printf("BENCH: CYCLES %" PRIu64 "\n", cycles);
+
+            if (!args.cycles_path.empty())
+            {
+                std::ofstream f(args.cycles_path);
+                f << cycles << '\n';
+            }
+        }
+
+        if (exit_code)
+        {
+            throw std::runtime_error("exit code");
+        }
+    }
+    catch (const std::exception &)
+    {
+        if (waves)
+        {
+            waves->fail(bench.gck());
+        }
+
+        throw;
+    }
+}
+
+
+// Parse the wave triggers from plusargs.
+static WaveTrigger wave_trigger(VerilatedContext &ctx)
+{
+    WaveTrigger trigger;
+
+    const std::string pc = plusarg(ctx, "waves_pc", "");
+    const std::string tick = plusarg(ctx, "waves_tick", "");
+    const std::string uart = plusarg(ctx, "waves_uart", "");
+
+    if (!pc.empty())
+    {
+        trigger.pc = std::stoi(pc, nullptr, 0);
+    }
+
+    if (!tick.empty())
+    {
+        const size_t sep = tick.find(':');
+        trigger.tick_start = std::stoll(tick.substr(0, sep), nullptr, 0);
+
+        if (sep != std::string::npos)
+        {
+            trigger.tick_end = std::stoll(tick.substr(sep + 1), nullptr, 0);
+        }
+    }
+
+    if (!uart.empty())
+    {
+        trigger.uart = std::stoi(uart, nullptr, 0);
+    }
+
+    trigger.pre = std::stoull(plusarg(ctx, "waves_pre", "1000"));
+    trigger.post = std::stoull(plusarg(ctx, "waves_post", "1000"));
+
+    return trigger;
+}
+
+
+// Run a single test given its arguments, returning the exit status. Each run
+// has its own context so batches can run many tests in one process.
+static int run_main(int argc, char **argv)
+{
+    VerilatedContext ctx;
+    ctx.commandArgs(argc, argv);
+
+    std::unique_ptr<Waves> waves;
+    int seed = 0;
+    int status = EXIT_SUCCESS;
+
+    Args args;
+
+    try
+    {
+        args.test = plusarg(ctx, "test");
+        args.yaml = plusarg(ctx, "yaml");
+        args.ckpt_path = plusarg(ctx, "checkpoint", "");
+        args.timeout_ns = std::stoull(plusarg(ctx, "timeout", "500000"));
+        args.lockstep = plusarg(ctx, "lockstep", "1") != "0";
+
+        args.cycles_path = plusarg(ctx, "cycles", "");
+        const std::string waves_path = plusarg(ctx, "waves", "");
+
+        // Decode table defaults to the one built alongside the executable.
+        const std::string exe = argv[0];
+        args.isa = plusarg(
+            ctx, "isa", (exe.substr(0, exe.find_last_of('/') + 1)
+                         + "isa.bin").c_str());
+
+        // Running again to dump waves relies on both runs seeing the same
+        // random values, so a seed is always set rather than left to the
+        // default of seeding from the system.
+        if (!waves_path.empty())
+        {
+            waves.reset(new Waves(waves_path, wave_trigger(ctx)));
+            ctx.traceEverOn(true);
+
+            seed = ctx.randSeed();
+            if (!seed)
+            {
+                seed = std::random_device()() & 0x7fffffff;
+                seed = seed ? seed : 1;
+            }
+
+            ctx.randSeed(seed);
+            std::printf("BENCH: SEED %d\n", seed);
+        }
+
+        run_test(ctx, args, waves.get());
+    }
+    catch (const std::exception &e)
+    {
+        std::printf("FAIL: %s\n", e.what());
+        status = EXIT_FAILURE;
+    }
+
+    // Run again from the same seed to dump the window around the trigger. The
+    // replay is expected to fail in the same way if the first run did.
+    if (waves && waves->triggered())
+    {
+        waves->replay();
+        ctx.randSeed(seed);
+
+        try
+        {
+            run_test(ctx, args, waves.get());
+        }
+        catch (const std::exception &)
+        {
+        }
+
+        waves->close();
+        std::printf("WAVES: %s from cycle %" PRIu64 "\n",
+                    waves->path().c_str(), waves->first());
+    }
+
+    if (status == EXIT_SUCCESS)
+    {
+        std::printf("PASS\n");
+    }
+
+    return status;
+}
+
+
+// Run a test from a batch with the arguments from its line followed by the
+// common ones, so that those on the line take priority. Output goes to the
+// file given by +log if there is one.
+static int run_batch_test(const std::string &exe,
+                          const std::vector<std::string> &line,
+                          const std::vector<std::string> &common)
+{
+    std::vector<std::string> args = {exe};
+    args.insert(args.end(), line.begin(), line.end());
+    args.insert(args.end(), common.begin(), common.end());
+
+    std::vector<char *> argv;
+    std::string log;
+
+    for (std::string &arg : args)
+    {
+        argv.push_back(arg.data());
+
+        if (arg.rfind("+log=", 0) == 0 && log.empty())
+        {
+            log = arg.substr(5);
+        }
+    }
+
+    argv.push_back(nullptr);
+
+    int saved = -1;
+    if (!log.empty())
+    {
+        std::fflush(stdout);
+
+        const int fd = open(log.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+        {
+            std::printf("FAIL: Failed to open log: %s\n", log.c_str());
+            return EXIT_FAILURE;
+        }
+
+        saved = dup(STDOUT_FILENO);
+        dup2(fd, STDOUT_FILENO);
+        close(fd);
+    }
+
+    const int status = run_main(argv.size() - 1, argv.data());
+
+    if (saved >= 0)
+    {
+        std::fflush(stdout);
+        dup2(saved, STDOUT_FILENO);
+        close(saved);
+    }
+
+    return status;
+}
+
+// Run every test in a batch file against this build, one test per line given
+// as plusargs. Tests are split between the given number of worker processes
+// and a line is printed for each as it finishes. Returns failure if any test
+// failed.
+static int run_batch(const std::string &exe, const std::string &path,
+                     int jobs, const std::vector<std::string> &common)
+{
+    std::ifstream f(path);
+    if (!f)
+    {
+        std::printf("FAIL: Failed to open batch: %s\n", path.c_str());
+        return EXIT_FAILURE;
+    }
+
+    std::vector<std::vector<std::string>> tests;
+
+    std::string line;
+    while (std::getline(f, line))
+    {
+        std::istringstream ss(line.substr(0, line.find('#')));
+        std::vector<std::string> args;
+
+        std::string arg;
+        while (ss >> arg)
+        {
+            args.push_back(arg);
+        }
+
+        if (!args.empty())
+        {
+            tests.push_back(args);
+        }
+    }
+
+    // Run the tests assigned to one worker, returning the number that failed.
+    auto worker = [&](int idx) -> int
+    {
+        int failed = 0;
+
+        for (size_t i = idx; i < tests.size(); i += jobs)
+        {
+            const auto start = std::chrono::steady_clock::now();
+            const int status = run_batch_test(exe, tests[i], common);
+            const std::chrono::duration<double> time
+                = std::chrono::steady_clock::now() - start;
+
+            failed += status != EXIT_SUCCESS;
+
+            std::string name;
+            for (const std::string &arg : tests[i])
+            {
+                name += (name.empty() ? "" : " ") + arg;
+            }
+
+            std::printf("BATCH: %s %.1fs %s\n",
+                        status == EXIT_SUCCESS ? "PASS" : "FAIL",
+                        time.count(), name.c_str());
+            std::fflush(stdout);
+        }
+
+        return failed;
+    };
+
+    jobs = std::max(1, std::min<int>(jobs, tests.size()));
+
+    int failed = 0;
+    if (jobs == 1)
+    {
+        failed = worker(0);
+    }
+    else
+    {
+        // Each worker is a separate process as the bench and the behavioural
+        // model's hooks are global.
+        std::fflush(stdout);
+
+        std::vector<pid_t> pids;
+        for (int i = 0; i < jobs; ++i)
+        {
+            const pid_t pid = fork();
+            if (pid == 0)
+            {
+                _exit(worker(i) ? EXIT_FAILURE : EXIT_SUCCESS);
+            }
+
+            if (pid < 0)
+            {
+                std::printf("FAIL: Failed to start batch worker\n");
+                failed++;
+                break;
+            }
+
+            pids.push_back(pid);
+        }
+
+        for (const pid_t pid : pids)
+        {
+            int status = 0;
+            if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status)
+                || WEXITSTATUS(status) != EXIT_SUCCESS)
+            {
+                failed++;
+            }
+        }
+    }
+
+    std::printf("BATCH: %zu tests, %s\n", tests.size(),
+                failed ? "FAIL" : "PASS");
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+
+int main(int argc, char **argv)
+{
+    VerilatedContext ctx;
+    ctx.commandArgs(argc, argv);
+
+    const std::string batch = plusarg(ctx, "batch", "");
+    if (batch.empty())
+    {
+        return run_main(argc, argv);
+    }
+
+    // Everything other than the batch options is passed on to each test.
+    std::vector<std::string> common;
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        if (arg.rfind("+batch=", 0) != 0 && arg.rfind("+jobs=", 0) != 0)
+        {
+            common.push_back(arg);
+        }
+    }
+
+    const int jobs = std::stoi(plusarg(ctx, "jobs", "1"));
+    return run_batch(argv[0], batch, jobs, common);
+}
@@ -0,0 +1,190 @@
+#ifndef IDLI_HARNESS_SQI_H
+#define IDLI_HARNESS_SQI_H
+
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <stdexcept>
+
+
+// Supported modes of the memory.
+#define SQI_MODE_WRITE  (0x2)
+#define SQI_MODE_READ   (0x3)
+
+
+// Native port of sqi.Memory: a cycle-accurate model of the Microchip
+// 23A512/23LC512 in SQI sequential mode. States follow the python model with
+// the address, dummy, write, and read cycles numbered.
+class SqiMemory
+{
+public:
+    // Memory is always 64K bytes.
+    static constexpr uint32_t SIZE = 1 << 16;
+
+    // Data written this cycle, if any.
+    struct Write
+    {
+        bool     vld;
+        uint16_t addr;
+        uint8_t  value;
+    };
+
+    explicit SqiMemory(const char *name) : m_name(name)
+    {
+        m_data.fill(-1);
+    }
+
+    // Load a byte via the backdoor before simulation begins.
+    void backdoor_load(uint16_t addr, uint8_t data)
+    {
+        m_data[addr] = data;
+    }
+
+    // Current value at an address, or -1 if uninitialised.
+    int data(uint16_t addr) const
+    {
+        return m_data[addr];
+    }
+
+    // Called on the rising edge of SCK with the 1b CS and 4b SIO values.
+    Write rising_edge(bool cs, uint8_t sio)
+    {
+        Write write = {false, 0, 0};
+
+        // CS high resets the memory back to waiting for a mode.
+        if (cs)
+        {
+            m_state = STATE_IDLE;
+            return write;
+        }
+
+        sio &= 0xf;
+
+        switch (m_state)
+        {
+        case STATE_IDLE:
+            m_mode = sio;
+            m_state = STATE_MODE;
+            break;
+
+        case STATE_MODE:
+            m_mode = (m_mode << 4) | sio;
+            if (m_mode != SQI_MODE_WRITE && m_mode != SQI_MODE_READ)
+            {
+                fail("Unknown mode", m_mode);
+            }
+
+            m_addr = 0;
+            m_state = STATE_ADDR0;
+            break;
+
+        case STATE_ADDR0:
+        case STATE_ADDR1:
+        case STATE_ADDR2:
+            m_addr = (m_addr << 4) | sio;
+            m_state = static_cast<state_t>(m_state + 1);
+            break;
+
+        case STATE_ADDR3:
+            m_addr = (m_addr << 4) | sio;
+            m_state = m_mode == SQI_MODE_READ ? STATE_DUMMY0 : STATE_WRITE0;
+            break;
+
+        case STATE_DUMMY0:
+            m_state = STATE_DUMMY1;
+            break;
+
+        case STATE_DUMMY1:
+            m_state = STATE_READ0;
+            break;
+
+        case STATE_WRITE0:
+        {
+            // Top 4b of the byte, keeping the bottom 4b until the next cycle.
+            const int value = m_data[m_addr] < 0 ? 0 : m_data[m_addr];
+            m_data[m_addr] = (sio << 4) | (value & 0xf);
+            m_state = STATE_WRITE1;
+            break;
+        }
+
+        case STATE_WRITE1:
+            m_data[m_addr] = (m_data[m_addr] & 0xf0) | sio;
+
+            write = {true, m_addr, static_cast<uint8_t>(m_data[m_addr])};
+            m_addr++;
+            m_state = STATE_WRITE0;
+            break;
+
+        case STATE_READ0:
+            m_state = STATE_READ1;
+            break;
+
+        case STATE_READ1:
+            m_state = STATE_READ0;
+            break;
+        }
+
+        return write;
+    }
+
+    // Called on the falling edge of SCK. Returns the 4b read data, or -1 if
+    // the memory isn't driving SIO.
+    int falling_edge()
+    {
+        if (m_state != STATE_READ0 && m_state != STATE_READ1)
+        {
+            return -1;
+        }
+
+        const int value = m_data[m_addr];
+        if (value < 0)
+        {
+            fail("Uninitialised read", m_addr);
+        }
+
+        if (m_state == STATE_READ0)
+        {
+            return (value >> 4) & 0xf;
+        }
+
+        // Second nibble moves on to the next sequential byte.
+        m_addr++;
+        return value & 0xf;
+    }
+
+private:
+    typedef enum
+    {
+        STATE_IDLE,
+        STATE_MODE,
+        STATE_ADDR0,
+        STATE_ADDR1,
+        STATE_ADDR2,
+        STATE_ADDR3,
+        STATE_DUMMY0,
+        STATE_DUMMY1,
+        STATE_WRITE0,
+        STATE_WRITE1,
+        STATE_READ0,
+        STATE_READ1,
+    } state_t;
+
+    [[noreturn]] void fail(const char *msg, unsigned value) const
+    {
+        char buf[64];
+        std::snprintf(buf, sizeof(buf), "%s: %s at 0x%04x", m_name, msg,
+                      value);
+        throw std::runtime_error(buf);
+    }
+
+    const char *m_name;
+
+    // Bytes of the memory with -1 marking uninitialised data.
+    std::array<int16_t, SIZE> m_data;
+
+    state_t  m_state = STATE_IDLE;
+    uint8_t  m_mode = 0;
+    uint16_t m_addr = 0;
+};
+
+#endif
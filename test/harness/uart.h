@@ -0,0 +1,135 @@
+#ifndef IDLI_HARNESS_UART_H
+#define IDLI_HARNESS_UART_H
+
+#include <cstdint>
+#include <deque>
+#include <stdexcept>
+
+
+// Native port of uart.URX, receiving data sent by the RTL. Data arrives as two
+// 8b frames, low byte first, which are combined into a 16b value.
+class UartRx
+{
+public:
+    // Called on the rising edge of GCK. Returns true when a complete 16b value
+    // has been received and stored in value.
+    bool rising_edge(bool bit, uint16_t &value)
+    {
+        // Wait in idle for the start bit.
+        if (m_bits < 0)
+        {
+            if (!bit)
+            {
+                m_bits = 0;
+                m_byte = 0;
+            }
+
+            return false;
+        }
+
+        m_byte |= bit << m_bits;
+        if (++m_bits < 8)
+        {
+            return false;
+        }
+
+        m_bits = -1;
+
+        if (!m_lo_vld)
+        {
+            m_lo = m_byte;
+            m_lo_vld = true;
+            return false;
+        }
+
+        m_lo_vld = false;
+        value = m_lo | (m_byte << 8);
+        return true;
+    }
+
+private:
+    // Bits received of the current byte, or -1 when idle.
+    int     m_bits = -1;
+    uint8_t m_byte = 0;
+
+    // Low byte waiting for its high byte.
+    uint8_t m_lo = 0;
+    bool    m_lo_vld = false;
+};
+
+
+// Native port of uart.UTX, sending queued data to the RTL when it's ready.
+class UartTx
+{
+public:
+    explicit UartTx(std::deque<uint16_t> &data) : m_data(data) {}
+
+    // Called on the rising edge of GCK with the RTL's ready signal. Returns
+    // the value to drive on the RX pin.
+    bool rising_edge(bool ready)
+    {
+        switch (m_state)
+        {
+        case STATE_IDLE_LO:
+            // Wait for ready then send the start bit.
+            if (!ready)
+            {
+                return 1;
+            }
+
+            if (m_data.empty())
+            {
+                throw std::runtime_error("No more data to send!");
+            }
+
+            m_bits = 0;
+            m_state = STATE_DATA;
+            return 0;
+
+        case STATE_DATA:
+        {
+            const bool out = (m_data.front() >> m_bits) & 1;
+
+            // After 8b go through idle to send the high byte, and after 16b
+            // the value is done.
+            if (++m_bits == 8)
+            {
+                m_state = STATE_IDLE_HI;
+            }
+            else if (m_bits == 16)
+            {
+                m_data.pop_front();
+                m_state = STATE_IDLE_LO;
+            }
+
+            return out;
+        }
+
+        case STATE_IDLE_HI:
+            m_state = STATE_START_HI;
+            return 1;
+
+        case STATE_START_HI:
+            m_state = STATE_DATA;
+            return 0;
+        }
+
+        return 1;
+    }
+
+private:
+    typedef enum
+    {
+        STATE_IDLE_LO,
+        STATE_DATA,
+        STATE_IDLE_HI,
+        STATE_START_HI,
+    } state_t;
+
+    std::deque<uint16_t> &m_data;
+
+    state_t m_state = STATE_IDLE_LO;
+    int     m_bits = 0;
+};
+
+#endif
@@ -0,0 +1,214 @@
+#ifndef IDLI_HARNESS_WAVES_H
+#define IDLI_HARNESS_WAVES_H
+
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+
+#include "verilated_fst_c.h"
+
+#include "Vidli_tb_m.h"
+
+
+// Conditions that start capturing waves, with -1 for any that aren't used. A
+// failure of the test always triggers a capture.
+struct WaveTrigger
+{
+    // PC of an instruction completing.
+    int       pc = -1;
+
+    // Number of instructions completed, optionally stopping the capture once
+    // the end is reached.
+    int64_t   tick_start = -1;
+    int64_t   tick_end = -1;
+
+    // Value sent over UART by the RTL.
+    int       uart = -1;
+
+    // GCK cycles captured before the trigger, and after it when there's no
+    // end to the tick window.
+    uint64_t  pre = 1000;
+    uint64_t  post = 1000;
+};
+
+
+// Triggered wave capture. Tracing is costly, so the test is first run without
+// it while the bench reports trigger conditions, recording the GCK cycle of
+// the first. If one fires the test is run again from the same random seed and
+// waves are dumped from the pre-trigger window up to the stop cycle. Passing
+// tests without a trigger therefore only pay for the first run.
+class Waves
+{
+public:
+    Waves(const std::string &path, const WaveTrigger &trigger)
+        : m_path(path),
+          m_trigger(trigger)
+    {
+    }
+
+    ~Waves()
+    {
+        close();
+    }
+
+    Waves(const Waves &) = delete;
+    Waves &operator=(const Waves &) = delete;
+
+    // Whether a trigger fired on the first run.
+    bool triggered() const
+    {
+        return m_start >= 0;
+    }
+
+    // Whether the test is being run again to dump waves.
+    bool replaying() const
+    {
+        return m_replay;
+    }
+
+    // Whether the window has been dumped, so the replay can stop early.
+    bool finished() const
+    {
+        return m_replay && m_finished;
+    }
+
+    // First GCK cycle captured, once triggered.
+    uint64_t first() const
+    {
+        return m_start;
+    }
+
+    const std::string &path() const
+    {
+        return m_path;
+    }
+
+    // Called when an instruction completes with the number of instructions
+    // completed so far, including this one.
+    void instr(uint64_t gck, uint16_t pc, uint64_t ticks)
+    {
+        if (m_trigger.pc >= 0 && pc == m_trigger.pc)
+        {
+            fire(gck, "pc");
+        }
+
+        if (m_trigger.tick_start >= 0
+            && ticks >= static_cast<uint64_t>(m_trigger.tick_start))
+        {
+            fire(gck, "tick");
+        }
+
+        // The end of the tick window replaces the post-trigger cycles.
+        if (!m_replay && triggered() && m_trigger.tick_end >= 0
+            && ticks >= static_cast<uint64_t>(m_trigger.tick_end)
+            && m_stop > static_cast<int64_t>(gck))
+        {
+            m_stop = gck;
+        }
+    }
+
+    // Called when the RTL sends a value over UART.
+    void uart(uint64_t gck, uint16_t value)
+    {
+        if (m_trigger.uart >= 0 && value == m_trigger.uart)
+        {
+            fire(gck, "uart");
+        }
+    }
+
+    // Called when the test fails. The capture always stops at the failure.
+    void fail(uint64_t gck)
+    {
+        fire(gck, "fail");
+
+        if (!m_replay && m_stop > static_cast<int64_t>(gck))
+        {
+            m_stop = gck;
+        }
+    }
+
+    // Prepare to run the test again to dump the recorded window. Must be
+    // called before the model for the second run is constructed.
+    void replay()
+    {
+        m_replay = true;
+        m_finished = false;
+    }
+
+    // Register the model being run again. Tracing is set up before the first
+    // eval, but the file isn't opened until the window starts.
+    void attach(Vidli_tb_m &top)
+    {
+        if (!m_replay)
+        {
+            return;
+        }
+
+        m_fst.reset(new VerilatedFstC);
+        top.trace(m_fst.get(), 99);
+    }
+
+    // Dump the state of the model at the given time if it's in the window.
+    void dump(uint64_t gck, uint64_t time)
+    {
+        if (!m_replay || !m_fst || m_finished
+            || static_cast<int64_t>(gck) < m_start)
+        {
+            return;
+        }
+
+        if (!m_fst->isOpen())
+        {
+            m_fst->open(m_path.c_str());
+        }
+
+        m_fst->dump(time);
+
+        if (static_cast<int64_t>(gck) > m_stop)
+        {
+            m_finished = true;
+            close();
+        }
+    }
+
+    void close()
+    {
+        if (m_fst && m_fst->isOpen())
+        {
+            m_fst->close();
+        }
+    }
+
+private:
+    // Record the first trigger of the first run, setting the window around it.
+    // Triggers on the replay are ignored as the window is already known.
+    void fire(uint64_t gck, const char *reason)
+    {
+        if (m_replay || triggered())
+        {
+            return;
+        }
+
+        std::printf("WAVES: TRIGGER %s at cycle %" PRIu64 "\n", reason, gck);
+
+        // With a tick window the stop is set once its end is reached.
+        m_start = gck > m_trigger.pre ? gck - m_trigger.pre : 0;
+        m_stop = m_trigger.tick_end >= 0 ? INT64_MAX : gck + m_trigger.post;
+    }
+
+    std::string m_path;
+    WaveTrigger m_trigger;
+
+    // Window of GCK cycles to dump, with the start -1 until triggered.
+    int64_t m_start = -1;
+    int64_t m_stop = -1;
+
+    bool m_replay = false;
+    bool m_finished = false;
+
+    std::unique_ptr<VerilatedFstC> m_fst;
+};
+
+#endif
@@ -48,8 +48,9 @@ module idli_tb_m import idli_pkg::*; (
   // Internal sync counter.
   ctr_t ctr;
 
-  // Whether an instruction has just finished.
-  logic instr_done_q;
+  // Whether an instruction has just finished. Public so the native verilator
+  // bench can read it directly.
+  logic instr_done_q /* verilator public_flat_rd */;
   logic instr_done_d;
 
   // Scoreboard of registers written. Set by the RTL and cleared by TB.
@@ -124,6 +125,17 @@ module idli_tb_m import idli_pkg::*; (
     else begin
       instr_done_q <= instr_done_d;
 
+`ifdef idli_tb_dpi_d
+      // Scoreboards are checked by the native bench when an instruction
+      // completes, so clear them here rather than from the bench. Anything
+      // set below for the next instruction takes priority.
+      if (instr_done_q) begin
+        reg_sb      <= '0;
+        pred_sb     <= '0;
+        pins_out_sb <= '0;
+      end
+`endif
+
       // On the first cycle of an instruction that's being run record whether
       // a register was written.
       if (ctr == '0 && debug.ex.dst_reg_wr) begin
@@ -157,6 +169,44 @@ module idli_tb_m import idli_pkg::*; (
   // Predicate register state.
   always_comb pred = debug.ex.pred;
 
+`ifdef idli_tb_dpi_d
+  // The native bench runs the behavioural model in lockstep, checking each
+  // instruction through DPI as it completes. Values are sampled on the edge
+  // after instr_done_q is set, so see the state that cocotb would have seen.
+  import "DPI-C" function void idli_tb_instr_done(
+    input int                     pc,
+    input int                     reg_sb,
+    input bit [NUM_REGS*16-1:0]   regs,
+    input bit                     pred_sb,
+    input bit                     pred,
+    input int                     pins_sb,
+    input int                     pins
+  );
+
+  logic [NUM_REGS-1:0][15:0] regs_dpi;
+
+  always_comb begin
+    regs_dpi = '0;
+    for (int unsigned REG = 1; REG < NUM_REGS; REG++) begin
+      regs_dpi[REG] = reg_data[REG];
+    end
+  end
+
+  always_ff @(posedge i_tb_gck) begin
+    if (i_tb_rst_n && instr_done_q) begin
+      idli_tb_instr_done(
+        32'(pc),
+        32'(reg_sb),
+        regs_dpi,
+        pred_sb,
+        pred,
+        32'(pins_out_sb),
+        32'(o_tb_pins)
+      );
+    end
+  end
+`endif
+
   // Wait until EX is stalled waiting for UART data and we're not about to
   // have a full buffer to process.
   always_comb o_tb_uart_rx_rdy = debug.ex.stall_urx
@@ -4,25 +4,33 @@
 import cocotb
 import os
 import pathlib
-import yaml
+import stim
 
 from tb import TestBench
 
 
+# Get an argument from plusargs given to the compiled model, e.g. +test=PATH,
+# falling back to the environment set up by the Makefile.
+def get_arg(name, default=None):
+    return cocotb.plusargs.get(name, os.environ.get(f'SIM_{name.upper()}',
+                                                    default))
+
+
 @cocotb.test()
 async def run_test(dut):
-    # Parse arguments from environment, accounting for the paths being relative
-    # to the parent directory.
-    path = '..'/pathlib.Path(os.environ['SIM_TEST'])
-    timeout = int(os.environ['SIM_TIMEOUT'])
-    config = pathlib.Path(os.environ['SIM_YAML'])
+    # Parse arguments, accounting for the paths being relative to the parent
+    # directory.
+    path = '..'/pathlib.Path(get_arg('test'))
+    timeout = int(get_arg('timeout'))
+    config = pathlib.Path(get_arg('yaml'))
+    cycles = get_arg('cycles')
 
-    with open('..'/config, 'r') as f:
-        config = yaml.safe_load(f)
+    config = stim.load('..'/config)
 
-    if config is None:
-        config = {}
+    # Cycle count is written next to the test for timing calibration.
+    if cycles:
+        cycles = '..'/pathlib.Path(cycles)
 
     # If running FPGA sim don't drive memories.
     fpga = 'fpga' in str(dut)
-    await TestBench(dut, path, config, timeout, fpga).run()
+    await TestBench(dut, path, config, timeout, fpga, cycles).run()